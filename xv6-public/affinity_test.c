@@ -0,0 +1,109 @@
+// CPU affinity test.
+// Run with several CPUs (make qemu CPUS=4): each worker
+// thread pins itself to one CPU and spins; the main thread
+// samples schedstat and checks that no worker is ever seen
+// on a CPU outside its mask.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedstat.h"
+
+#define NWORKER   3
+#define DURATION  200  // ticks to spin
+
+struct schedstat st;
+struct threadstat ts[NTHREAD];
+
+int ncpu;
+int mask[NWORKER];
+thread_t tid[NWORKER];
+volatile int pinned[NWORKER];
+volatile int stop;
+
+void*
+worker(void *arg)
+{
+  int i = (int)arg;
+
+  if(sched_setaffinity(0, mask[i]) < 0){
+    printf(1, "worker %d: sched_setaffinity failed\n", i);
+    pinned[i] = 1;
+    thread_exit((void*)1);
+  }
+  if(sched_getaffinity(0) != mask[i]){
+    printf(1, "worker %d: sched_getaffinity returned %x\n", i,
+           sched_getaffinity(0));
+    pinned[i] = 1;
+    thread_exit((void*)1);
+  }
+  pinned[i] = 1;
+  while(!stop)
+    ;
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, pid, end, failed;
+  void *ret;
+
+  if(schedstat(&st, ts, 0) < 0){
+    printf(1, "schedstat failed\n");
+    exit();
+  }
+  ncpu = st.ncpu;
+  printf(1, "affinity test start (%d cpus)\n", ncpu);
+
+  failed = 0;
+  if(sched_setaffinity(0, 0) >= 0){
+    printf(1, "empty mask accepted\n");
+    failed = 1;
+  }
+  if(sched_getaffinity(0) != (1 << ncpu) - 1){
+    printf(1, "default mask %x\n", sched_getaffinity(0));
+    failed = 1;
+  }
+
+  for(i = 0; i < NWORKER; i++){
+    mask[i] = 1 << (i % ncpu);
+    if(thread_create(&tid[i], worker, (void*)i) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+
+  for(i = 0; i < NWORKER; i++)
+    while(!pinned[i])
+      sleep(1);
+
+  pid = getpid();
+  end = uptime() + DURATION;
+  while(uptime() < end){
+    sleep(5);
+    n = schedstat(&st, ts, sizeof(ts)/sizeof(ts[0]));
+    for(j = 0; j < n; j++){
+      if(ts[j].pid != pid)
+        continue;
+      for(i = 0; i < NWORKER; i++){
+        if(ts[j].tid != tid[i] || ts[j].cpu < 0)
+          continue;
+        if((mask[i] & (1 << ts[j].cpu)) == 0){
+          printf(1, "worker %d on cpu %d, mask %x\n", i, ts[j].cpu, mask[i]);
+          failed = 1;
+        }
+      }
+    }
+  }
+  stop = 1;
+
+  for(i = 0; i < NWORKER; i++){
+    if(thread_join(tid[i], &ret) < 0 || ret != 0)
+      failed = 1;
+  }
+  printf(1, failed ? "affinity test failed\n" : "affinity test ok\n");
+  exit();
+}
@@ -9,6 +9,8 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct schedstat;
+struct threadstat;
 
 // bio.c
 void            binit(void);
@@ -36,6 +38,7 @@ int             filewrite(struct file*, char*, int n);
 
 // fs.c
 extern char     user[16];
+extern int      isroot;
 int             max(int, int);
 int             login(char*, char*, char*);
 int             chmod(char*, int);
@@ -86,6 +89,7 @@ extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
 void            lapicstartap(uchar, uint);
+void            lapicipi(uchar, int);
 void            microdelay(int);
 
 // log.c
@@ -113,15 +117,16 @@ int             pipewrite(struct pipe*, char*, int);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
-int             growproc(int);
+int             growproc(int, uint*);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 struct thread*  mythread();
 struct proc*    getproc(int);
-void		resetproc(struct proc*);
-void		increasetq(struct proc*);
+void		resetthread(struct thread*);
+int		increasetq(struct thread*);
 void		priorityboost(void);
+int		preempt(struct thread*);
 void            pinit(void);
 void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
@@ -133,10 +138,21 @@ void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
+void            preemptyield(void);
 struct thread*  thread_create(thread_t*, void*, void*);
 void            thread_exit(void*);
 int             thread_join(thread_t, void**);
+int             thread_yield_to(int);
 int             isinitproc(struct proc*);
+int             schedstat(struct schedstat*, struct threadstat*, int);
+int             setaffinity(int, uint);
+int             getaffinity(int);
+int             setrtprio(int, int);
+int             setschedpolicy(int);
+int             futexwait(uint, int);
+int             futexwake(uint, int);
+int             settls(uint);
+void            setaccount(char*);
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -147,6 +163,7 @@ void            getcallerpcs(void*, uint*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
+int             tryacquire(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
@@ -199,6 +216,7 @@ void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*, struct thread*);
+void            switchthread(struct proc*, struct thread*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
@@ -2,6 +2,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
 #include "x86.h"
@@ -19,6 +20,7 @@ exec(char *path, char **argv)
   pde_t *pgdir, *oldpgdir;
   struct thread *curthread = mythread();
   struct proc *curproc = curthread->proc;
+  struct thread *t;
 
   begin_op();
 
@@ -103,6 +105,13 @@ exec(char *path, char **argv)
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
+  // Thread stacks of the old image are gone with it.
+  acquire(&curproc->lock);
+  curproc->pggen++;
+  for(t = curproc->threads; t != 0; t = t->pnext)
+    t->ustack = 0;
+  release(&curproc->lock);
+  curthread->tls = 0;
   curthread->tf->eip = elf.entry;  // main
   curthread->tf->esp = sp;
   switchuvm(curproc, curthread);
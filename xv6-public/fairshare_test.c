@@ -0,0 +1,150 @@
+// Fair-share scheduling test.
+// alice logs in and starts one CPU-bound process, bob logs
+// in and starts NBOB.  Under the fair-share class each user
+// should get half of the CPU however many processes they
+// run, and bob's half should be split evenly among his.
+// CPU use is read from schedstat's per-thread tick counts.
+// Needs one CPU (make qemu CPUS=1) and root, which it logs
+// back in as at the end.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedstat.h"
+
+#define NBOB      4
+#define NSPIN     (1 + NBOB)
+#define DURATION  500  // ticks to measure
+#define TOLERANCE 10   // allowed error, in percent of total CPU
+
+char users[500];
+struct schedstat st;
+struct threadstat ts[NTHREAD];
+int pid[NSPIN];        // alice's process, then bob's
+
+// Log in as name, start n processes that spin until killed,
+// and send their pids down fd.
+void
+tenant(char *name, char *password, int n, int fd)
+{
+  int i, p;
+
+  if(login(users, name, password) < 0){
+    printf(1, "login %s failed\n", name);
+    p = -1;
+    write(fd, &p, sizeof(p));
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if((p = fork()) == 0)
+      for(;;)
+        ;
+    write(fd, &p, sizeof(p));
+  }
+  while(wait() != -1)
+    ;
+  exit();
+}
+
+// Start a tenant and read its n pids into pids.
+void
+start(char *name, char *password, int n, int *pids)
+{
+  int fd[2], i;
+
+  if(pipe(fd) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    close(fd[0]);
+    tenant(name, password, n, fd[1]);
+  }
+  close(fd[1]);
+  for(i = 0; i < n; i++){
+    if(read(fd[0], &pids[i], sizeof(pids[i])) != sizeof(pids[i]) ||
+       pids[i] < 0){
+      printf(1, "%s: no process %d\n", name, i);
+      exit();
+    }
+  }
+  close(fd[0]);
+}
+
+// Ticks each spinner has run so far.
+void
+sample(uint *ticks)
+{
+  int i, j, k, n;
+
+  if((n = schedstat(&st, ts, NTHREAD)) < 0){
+    printf(1, "schedstat failed\n");
+    exit();
+  }
+  for(i = 0; i < NSPIN; i++){
+    ticks[i] = 0;
+    for(j = 0; j < n; j++)
+      if(ts[j].pid == pid[i])
+        for(k = 0; k < MLFQ_K; k++)
+          ticks[i] += ts[j].levticks[k];
+  }
+}
+
+// Print one line of the result and check a share, in
+// percent of total, against expect.
+int
+check(char *who, uint used, uint total, int expect)
+{
+  int share, err;
+
+  share = used * 100 / total;
+  err = share > expect ? share - expect : expect - share;
+  printf(1, "%s: %d ticks, %d%% of CPU (expected %d%%)\n",
+         who, used, share, expect);
+  return err > TOLERANCE;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint before[NSPIN], after[NSPIN], total, bob;
+  int i, old, failed;
+
+  strcpy(users, "root 0000\nalice a\nbob b\n");
+  if((old = setschedpolicy(FAIRSHARE_SCHED)) < 0){
+    printf(1, "setschedpolicy failed\n");
+    exit();
+  }
+  printf(1, "fairshare test start\n");
+  start("alice", "a", 1, &pid[0]);
+  start("bob", "b", NBOB, &pid[1]);
+
+  sample(before);
+  sleep(DURATION);
+  sample(after);
+  for(i = 0; i < NSPIN; i++)
+    kill(pid[i]);
+  while(wait() != -1)
+    ;
+  login(users, "root", "0000");
+  setschedpolicy(old);
+
+  total = bob = 0;
+  for(i = 0; i < NSPIN; i++){
+    after[i] -= before[i];
+    total += after[i];
+    if(i > 0)
+      bob += after[i];
+  }
+  if(total == 0){
+    printf(1, "fairshare test failed: no ticks\n");
+    exit();
+  }
+  failed = check("alice", after[0], total, 50);
+  failed |= check("bob", bob, total, 50);
+  for(i = 1; i < NSPIN; i++)
+    failed |= check(" bob's process", after[i], total, 50 / NBOB);
+  printf(1, failed ? "fairshare test failed\n" : "fairshare test ok\n");
+  exit();
+}
@@ -14,8 +14,8 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
@@ -56,6 +56,7 @@ login(char* users, char *username, char *password)
           isroot = 1;
         else
           isroot = 0;
+        setaccount(username);
         return 0;
       }
       tempi = -1;
@@ -0,0 +1,81 @@
+// futex test.
+// Checks that futex_wait returns at once if the word has
+// changed, then parks NWAITER threads on one word and wakes
+// them one at a time, checking each futex_wake count.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NWAITER 4
+
+volatile int word;
+volatile int nwaiting;
+volatile int nwoken;
+
+void*
+waiter(void *arg)
+{
+  __sync_fetch_and_add(&nwaiting, 1);
+  while(word == 0)
+    futex_wait(&word, 0);
+  __sync_fetch_and_add(&nwoken, 1);
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t tid[NWAITER];
+  int i, n, woke, failed;
+  void *ret;
+
+  printf(1, "futex test start\n");
+  failed = 0;
+  if(futex_wait(&word, 1) != -1){
+    printf(1, "futex_wait slept on a changed word\n");
+    failed = 1;
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf(1, "futex_wake woke a thread nobody parked\n");
+    failed = 1;
+  }
+  if(futex_wait((int*)1, 0) != -1){
+    printf(1, "futex_wait took a bad address\n");
+    failed = 1;
+  }
+
+  for(i = 0; i < NWAITER; i++){
+    if(thread_create(&tid[i], waiter, 0) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  while(nwaiting < NWAITER)
+    sleep(1);
+  sleep(10);  // let them all block
+
+  word = 1;
+  woke = 0;
+  for(i = 0; i < NWAITER; i++){
+    n = futex_wake(&word, 1);
+    if(n != 1){
+      printf(1, "futex_wake woke %d, expected 1\n", n);
+      failed = 1;
+    }
+    woke += n;
+  }
+  if(futex_wake(&word, NWAITER) != 0){
+    printf(1, "futex_wake found a waiter left\n");
+    failed = 1;
+  }
+  for(i = 0; i < NWAITER; i++)
+    thread_join(tid[i], &ret);
+  if(nwoken != NWAITER || woke != NWAITER){
+    printf(1, "%d threads woke, %d wakeups\n", nwoken, woke);
+    failed = 1;
+  }
+  printf(1, failed ? "futex test failed\n" : "futex test ok\n");
+  exit();
+}
@@ -1,5 +1,6 @@
 #define NPROC        64  // maximum number of processes
-#define NTHREAD       6  // maximum number of threads
+#define NTHREAD     512  // maximum number of threads
+#define MAXTHREAD   256  // maximum number of threads per process
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
@@ -11,8 +12,14 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks
 #define MAXPID 2147483647 // max pid
+#define MAXPRIO      10  // max setpriority() priority
+#define MAXRTPRIO     8  // max setrtprio() real-time priority
+#define NACCOUNT     10  // users with a fair-share CPU account
+#ifndef MLFQ_K
+#define MLFQ_K        5  // MLFQ levels, normally set by the Makefile
+#endif
 
 #ifndef MODES
   #define MODES
@@ -4,19 +4,145 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "proc.h"
+#include "traps.h"
+#include "schedstat.h"
 
-#ifndef MLFQ_K
-#define MLFQ_K 5
-#endif
+// Time quantum of MLFQ level i, in ticks.
+#define MLFQ_TQ(i) ((i)*4+2)
 
+// Sleeping threads hang off a hash table of wait queues keyed
+// by chan, so that wakeup only looks at threads that might be
+// waiting on its channel.  NWAITQ must be 1<<WAITQ_SHIFT.
+#define WAITQ_SHIFT 6
+#define NWAITQ      (1<<WAITQ_SHIFT)
+#define WAITQ(chan) ((uint)(chan) * 2654435761U >> (32 - WAITQ_SHIFT))
+
+struct waitq {
+  struct spinlock lock;
+  struct thread *head;
+  struct spinlock futex;       // See futexwait
+};
+
+// Locking.  ptable.lock guards the allocation of proc slots
+// and the parent/child links that wait() and exit() use.
+// Each proc's lock guards the states of its threads, killed
+// and threadcnt, and a thread giving up the CPU holds it
+// across swtch.  A run queue lock guards the queue and the
+// cpu field of the threads on it; a wait queue lock guards
+// the queue.  Lock order: ptable.lock, proc lock, wait queue
+// lock, run queue lock.  No two proc locks are ever waited
+// for at once: sched() only tries for a second one, and
+// fork() only waits for its child's, which has never run.
+//
+// Threads come from a pool.  A proc keeps the ones it got
+// on its list, reusing UNUSED ones first, until wait()
+// reaps it and gives them all back.  ptable.threadlock
+// guards the free list and is taken last.
+//
+// Each CPU runs its own MLFQ, so the thread holding the
+// time slice of a level is tracked per CPU, and only
+// touched by that CPU.
 struct {
-  struct proc *runningproc[MLFQ_K];
+  struct thread *runningthread[NCPU][MLFQ_K];
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct spinlock threadlock;
+  struct thread thread[NTHREAD];
+  struct thread *freethread;   // Free list, linked by pnext
+  struct waitq waitq[NWAITQ];  // Sleeping threads, by WAITQ(chan)
+  struct account acct[NACCOUNT];  // CPU accounts, by login name
+  uint nboost;                 // priorityboost() runs
+  volatile uint boostepoch;    // bumped by every priorityboost()
 } ptable;
 
+// Stride scheduling: a thread holds priority+1 tickets and its
+// pass advances by STRIDE1/tickets for every tick it runs; the
+// thread with the smallest pass runs next.  Passes wrap, so
+// they are compared by signed difference.
+#define STRIDE1      (1<<16)
+#define TICKETS(t)   ((t)->priority + 1)
+#define PASSLESS(a, b) ((int)((a)->pass - (b)->pass) < 0)
+
+// Fair-share scheduling runs on the stride machinery, but
+// splits the CPU evenly among the users with runnable
+// threads, then among each user's active processes, then
+// among each process's active threads.  A thread's share is
+// thus 1/(users * procs of its user * threads of its proc);
+// the users factor is common to every thread, so its stride
+// only scales with the other two.
+#define FAIRSTRIDE(t) (STRIDE1 * (t)->proc->acct->nactive * (t)->proc->nactive)
+
+// Number of run queue slots.  Real-time threads come first,
+// one slot per priority, highest first.  The classes that
+// keep the other threads in slots use the ones after those;
+// MLFQ needs the most, one per level and priority.
+#define NRTQ MAXRTPRIO
+#define NRUNQ (NRTQ + MLFQ_K * (MAXPRIO+1))
+
+// Per-CPU run queue of RUNNABLE threads.  A thread is linked
+// on exactly one run queue for as long as it is RUNNABLE, so
+// the scheduler picks in O(1) instead of scanning ptable.
+// The stride and fair-share classes keep the threads outside
+// the real-time class on a binary min-heap on pass instead,
+// for O(log n) picks.
+struct runq {
+  struct spinlock lock;
+  struct thread *head[NRUNQ];
+  struct thread *tail[NRUNQ];
+  struct thread *heap[NTHREAD];
+  int nheap;
+  uint vpass;                  // pass of the last thread picked
+  volatile int nrunnable;
+  uint lastbalance;            // ticks at last balance()
+  uint epoch;                  // boost epoch the slots reflect
+  struct cpustat stat;         // Only updated by the owning CPU
+};
+
+// A scheduling class orders the threads outside the
+// real-time class on every run queue.  One class is in force
+// at a time (see setschedpolicy); it starts as SCHED_POLICY.
+// All ops except tick are called with the queue's lock held.
+struct schedclass {
+  char *name;
+  // Run queue slot for t, for the classes that use slots.
+  int (*slot)(struct thread *t);
+  void (*enqueue)(struct runq *rq, struct thread *t, int athead);
+  void (*dequeue)(struct runq *rq, struct thread *t);
+  // Unlink and return the next thread to run whose proc
+  // lock could be taken (see claim), or 0.
+  struct thread* (*pick_next)(struct runq *rq, struct proc *cur);
+  // Charge the running thread t for a tick; 1 if it should
+  // yield.  Runs without any lock (see increasetq).
+  int (*tick)(struct thread *t);
+  // Catch rq up with priorityboost(), or 0 if the class
+  // has no priorities to boost.
+  void (*boost)(struct runq *rq);
+  // Should t, giving up the CPU in yield(), be queued at
+  // the head of its slot?  0 means never.
+  int (*keep)(struct thread *t);
+  // Should the running thread t give way to one on rq?
+  int (*urgent)(struct runq *rq, struct thread *t);
+  // Thread before t in steal() order, least urgent first,
+  // or the last one if t is 0.
+  struct thread* (*prev)(struct runq *rq, struct thread *t);
+};
+
+// A thread that ran within the last MIGRATE_HOT ticks is
+// cache-hot on its CPU; balance() only moves it to a CPU
+// that would otherwise sit idle.
+#define MIGRATE_HOT    1
+// How often a busy CPU checks for imbalance, in ticks.
+#define BALANCE_TICKS  4
+// May thread t run on CPU c?
+#define CANRUN(t, c)   ((t)->affinity & (1 << (c)))
+// Affinity mask with every CPU set.
+#define ALLCPUS        ((1 << ncpu) - 1)
+
+static struct runq runqs[NCPU];
+static struct schedclass *sclass;  // Class in force, see setschedpolicy
+
 static struct proc *initproc;
 
 int nextpid = 1;
@@ -24,8 +150,21 @@ int nexttid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
-static void wakeup2(void *chan);
+static struct thread* wakeup2(void *chan);
+static void enqueue(struct thread *t, int athead);
+static void setrunnable(struct thread *t);
+static void rqremove(struct thread *t);
+static void finishswitch(struct cpu *c);
+static int handoff(struct thread *t);
+static void schedto(struct thread *next);
+static void catchup(struct thread *t);
+static void boostthread(struct thread *t);
+static void wqinsert(struct thread *t);
+static void wqremove(struct thread *t);
+static int rqurgent(struct runq *rq, struct thread *t);
+static void rqpush(struct runq *rq, struct thread *t, int athead);
+static void rqunlink(struct runq *rq, struct thread *t);
+static int mlfqkeep(struct thread *t);
 
 void
 pinit(void)
@@ -34,16 +173,26 @@ pinit(void)
   struct thread *t;
 
   initlock(&ptable.lock, "ptable");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runqs[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++){
+    initlock(&ptable.waitq[i].lock, "waitq");
+    initlock(&ptable.waitq[i].futex, "futex");
+  }
 
   acquire(&ptable.lock);
-  for(int i = 0; i < MLFQ_K; i++) {
-    ptable.runningproc[i] = 0;
+  for(int i = 0; i < NCPU; i++) {
+    for(int j = 0; j < MLFQ_K; j++)
+      ptable.runningthread[i][j] = 0;
   }
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    for(t = p->threads; t < &p->threads[NTHREAD]; t++) {
-      t->proc = p;
-    }
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    initlock(&p->lock, "proc");
+
+  initlock(&ptable.threadlock, "threads");
+  for(t = ptable.thread; t < &ptable.thread[NTHREAD]; t++){
+    t->pnext = ptable.freethread;
+    ptable.freethread = t;
   }
   release(&ptable.lock);
 }
@@ -111,22 +260,68 @@ getproc(int pid) {
   return p;
 }
 
+// Take a thread from the pool and link it, UNUSED and
+// without a stack, into p's list at *tp.  Returns 0 if the
+// pool is empty.
 static struct thread*
-allocthread(struct proc *p)
+takethread(struct proc *p, struct thread **tp)
 {
   struct thread *t;
-  char *sp;
 
-  for(t = p->threads; t < &p->threads[NTHREAD]; t++)
-    if(t->state == UNUSED)
-      goto foundt;
+  acquire(&ptable.threadlock);
+  if((t = ptable.freethread) != 0)
+    ptable.freethread = t->pnext;
+  release(&ptable.threadlock);
+  if(t == 0)
+    return 0;
+  t->proc = p;
+  t->pnext = 0;
+  t->state = UNUSED;
+  t->ustack = 0;
+  *tp = t;
+  return t;
+}
+
+// Set up a thread of p to start in forkret: an UNUSED one
+// already on p's list, one with a user stack left first,
+// or else one from the pool, appended to the list.
+// Fails once p has MAXTHREAD threads.
+// Called with ptable.lock held for a new proc, or with p's
+// lock held.
+static struct thread*
+allocthread(struct proc *p)
+{
+  struct thread *t, *best, **tp;
+  char *sp;
 
-  return 0;
+  if(p->threadcnt >= MAXTHREAD)
+    return 0;
 
-foundt:
+  best = 0;
+  for(tp = &p->threads; (t = *tp) != 0; tp = &t->pnext){
+    if(t->state == UNUSED && (best == 0 || (t->ustack && !best->ustack)))
+      best = t;
+    if(best && best->ustack)
+      break;
+  }
+  if((t = best) == 0 && (t = takethread(p, tp)) == 0)
+    return 0;
 
   t->state = EMBRYO;
-  t->tid = nexttid++;
+  t->tid = __sync_fetch_and_add(&nexttid, 1);
+  t->cpu = -1;
+  t->qlevel = 0;
+  t->usedtq = 0;
+  t->priority = 0;
+  t->waitcycles = 0;
+  t->nvcsw = t->nivcsw = 0;
+  t->ndemote = t->nboost = 0;
+  t->pass = 0;
+  t->affinity = ~0;
+  t->rtprio = 0;
+  t->tls = 0;
+  t->epoch = ptable.boostepoch;
+  memset(t->levticks, 0, sizeof(t->levticks));
 
   // Allocate kernel stack.
   if((t->kstack = kalloc()) == 0){
@@ -155,6 +350,28 @@ foundt:
   return t;
 }
 
+// Give all of p's threads back to the pool.  None of them
+// may be running.  Called with ptable.lock or p's lock held.
+static void
+freethreads(struct proc *p)
+{
+  struct thread *t, *next;
+
+  acquire(&ptable.threadlock);
+  for(t = p->threads; t != 0; t = next){
+    next = t->pnext;
+    if(t->kstack){
+      kfree(t->kstack);
+      t->kstack = 0;
+    }
+    t->state = UNUSED;
+    t->pnext = ptable.freethread;
+    ptable.freethread = t;
+  }
+  release(&ptable.threadlock);
+  p->threads = 0;
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -164,7 +381,7 @@ static struct proc*
 allocproc(int threads)
 {
   struct proc *p;
-  int i, j;
+  int i;
 
   acquire(&ptable.lock);
 
@@ -177,15 +394,15 @@ allocproc(int threads)
 
 found:
   p->pid = nextpid++;
+  p->nactive = 0;
 
-  // allocate main thread in p.threads[0] //hj
+  // The first thread allocated is the main thread.
   for(i = 0; i < threads; i++) {
     if (allocthread(p) == 0) {
-      for(j = 0; j < i; j++) {
-        kfree(p->threads[i].kstack);
-        p->threads[i].kstack = 0;
-        p->threads[i].state = UNUSED;
-      }
+      freethreads(p);
+      p->threadcnt = 0;
+      p->pid = 0;
+      release(&ptable.lock);
       return 0;
     }
   }
@@ -195,35 +412,138 @@ found:
   return p;
 }
 
-void resetproc(struct proc* p)
+// Move the running thread t back to the top MLFQ level.
+// Only t's own CPU touches its quantum, so no lock is needed.
+void resetthread(struct thread *t)
 {
-  acquire(&ptable.lock);
-  if(ptable.runningproc[p->qlevel] == p)
-    ptable.runningproc[p->qlevel] = 0;
-  p->usedtq = 0;
-  p->qlevel = 0;
-  release(&ptable.lock);
+  struct thread **slice;
+
+  pushcli();
+  slice = &ptable.runningthread[cpuid()][t->qlevel];
+  if(*slice == t)
+    *slice = 0;
+  t->usedtq = 0;
+  t->qlevel = 0;
+  popcli();
 }
 
-void increasetq(struct proc *p)
+// Charge the running thread t for one timer tick, without
+// taking any lock.  Returns 1 if t should yield, as its
+// scheduling class decides.  A real-time thread has no
+// quantum and is never demoted; it only yields to a higher
+// real-time priority.
+// The run queue is only peeked at, unlocked, here and in
+// preempt: a stale answer costs at most one tick's delay or
+// a needless trip through yield.
+int increasetq(struct thread *t)
 {
-  acquire(&ptable.lock);
-  p->usedtq++;
-  release(&ptable.lock);
+  if(t->rtprio)
+    return rqurgent(&runqs[t->cpu], t);
+  catchup(t);
+  t->usedtq++;
+  t->levticks[t->qlevel]++;
+  return sclass->tick(t);
+}
+
+// Should the running thread t give up its CPU to a thread
+// just queued there?  Checked on a reschedule interrupt
+// (see kick).  Racy peek, see increasetq.
+int preempt(struct thread *t)
+{
+  return rqurgent(&runqs[t->cpu], t);
 }
 
+// Lift every thread back to MLFQ level 0.  Runs from the
+// timer interrupt, so it only opens a new epoch; threads
+// catch up when next queued, picked or ticked (catchup), and
+// each CPU moves its queued threads up on its next pick
+// (rqboost).  Only CPU 0 calls this.
 void priorityboost(void)
 {
+  ptable.nboost++;
+  ptable.boostepoch++;
+}
+
+// Apply a priority boost that t has missed: back to level
+// 0 with a fresh quantum.  Real-time threads are not
+// boosted.  Called with t off any run queue or by the CPU
+// running it.
+static void
+catchup(struct thread *t)
+{
+  if(t->epoch == ptable.boostepoch || t->rtprio)
+    return;
+  boostthread(t);
+}
+
+// Move t to level 0 with a fresh quantum, as of the latest
+// boost, whatever epoch it last saw.
+static void
+boostthread(struct thread *t)
+{
+  t->epoch = ptable.boostepoch;
+  if(t->qlevel != 0)
+    t->nboost++;
+  t->qlevel = 0;
+  t->usedtq = 0;
+}
+
+// t has become RUNNABLE after sleeping or being created.
+// A thread counts as active from then until it sleeps or
+// exits, and a proc is active while any of its threads
+// is.  t's proc lock must be held; accounts are shared by
+// procs, so their counts are updated atomically.
+static void
+activate(struct thread *t)
+{
+  struct proc *p = t->proc;
+
+  if(p->nactive++ == 0)
+    __sync_fetch_and_add(&p->acct->nactive, 1);
+}
+
+static void
+deactivate(struct thread *t)
+{
+  struct proc *p = t->proc;
+
+  if(--p->nactive == 0)
+    __sync_fetch_and_sub(&p->acct->nactive, 1);
+}
+
+// Charge the current process to the CPU account of the user
+// name, who has just logged in, creating the account if need
+// be.  Children inherit it.  If every account is taken, the
+// process stays where it is.
+void
+setaccount(char *name)
+{
+  struct proc *p = myproc();
+  struct account *a, *free;
+
   acquire(&ptable.lock);
-  for(int i = 0; i < MLFQ_K; i++) {
-    ptable.runningproc[i] = 0;
+  free = 0;
+  for(a = ptable.acct; a < &ptable.acct[NACCOUNT]; a++){
+    if(a->name[0] == 0){
+      if(free == 0)
+        free = a;
+    } else if(strncmp(a->name, name, sizeof(a->name)) == 0)
+      break;
   }
-
-  struct proc *p;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-    p->qlevel = 0;
-    p->usedtq = 0;
+  if(a == &ptable.acct[NACCOUNT]){
+    if((a = free) == 0){
+      release(&ptable.lock);
+      return;
+    }
+    safestrcpy(a->name, name, sizeof(a->name));
+  }
+  acquire(&p->lock);
+  if(p->nactive > 0){
+    __sync_fetch_and_sub(&p->acct->nactive, 1);
+    __sync_fetch_and_add(&a->nactive, 1);
   }
+  p->acct = a;
+  release(&p->lock);
   release(&ptable.lock);
 }
 
@@ -240,6 +560,8 @@ userinit(void)
   t = p->threads;
   
   initproc = p;
+  safestrcpy(ptable.acct[0].name, "root", sizeof(ptable.acct[0].name));
+  p->acct = &ptable.acct[0];
   if((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
@@ -249,6 +571,7 @@ userinit(void)
   t->tf->ds = (SEG_UDATA << 3) | DPL_USER;
   t->tf->es = t->tf->ds;
   t->tf->ss = t->tf->ds;
+  t->tf->gs = (SEG_UTLS << 3) | DPL_USER;
   t->tf->eflags = FL_IF;
   t->tf->esp = PGSIZE;
   t->tf->eip = 0;  // beginning of initcode.S
@@ -260,32 +583,78 @@ userinit(void)
   // run this process. the acquire forces the above
   // writes to be visible, and the lock is also needed
   // because the assignment might not be atomic.
-  acquire(&ptable.lock);
+  acquire(&p->lock);
 
-  t->state = RUNNABLE;
+  setrunnable(t);
 
-  release(&ptable.lock);
+  release(&p->lock);
+}
+
+// Free the user stacks of p's joined threads that sit at
+// the top of its memory, lowering p->sz past them.  Stacks
+// further down must stay: system calls check user pointers
+// against sz alone, so every page below it stays mapped.
+// Returns the number of stacks freed.  Called with p's lock
+// held.
+static int
+reclaimstacks(struct proc *p)
+{
+  struct thread *t;
+  int n;
+
+  for(n = 0; ; n++){
+    for(t = p->threads; t != 0; t = t->pnext)
+      if(t->state == UNUSED && t->ustack != 0 && t->ustack == p->sz)
+        break;
+    if(t == 0)
+      break;
+    p->sz = deallocuvm(p->pgdir, p->sz, p->sz - 2*PGSIZE);
+    t->ustack = 0;
+  }
+  if(n)
+    p->pggen++;
+  return n;
 }
 
-// Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Grow current process's memory by n bytes, and store the
+// old size, where the new memory starts, in *oldszp.
+// Freeing idle stacks may lower the size first, so callers
+// can't read it beforehand.  Return 0 on success, -1 on
+// failure.
 int
-growproc(int n)
+growproc(int n, uint *oldszp)
 {
   uint sz;
   struct thread *curthread = mythread();
   struct proc *curproc = curthread->proc;
+  struct thread *t;
 
+  acquire(&curproc->lock);
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Short of memory, give up idle thread stacks first.
+    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0 &&
+       (!reclaimstacks(curproc) ||
+        (sz = allocuvm(curproc->pgdir, curproc->sz, curproc->sz + n)) == 0)){
+      switchuvm(curproc, curthread);
+      release(&curproc->lock);
       return -1;
+    }
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&curproc->lock);
       return -1;
+    }
+    curproc->pggen++;
+    // Forget idle stacks that were cut off.
+    for(t = curproc->threads; t != 0; t = t->pnext)
+      if(t->state == UNUSED && t->ustack > sz)
+        t->ustack = 0;
   }
+  *oldszp = curproc->sz;
   curproc->sz = sz;
   switchuvm(curproc, curthread);
+  release(&curproc->lock);
   return 0;
 }
 
@@ -296,21 +665,29 @@ thread_create(thread_t *thread, void *start_routine, void *arg)
   struct proc *curproc = myproc();
   struct thread *t;
   uint sp, sz;
-  
-  sz = curproc->sz;
-  sz = PGROUNDUP(sz);
-  if((sz = allocuvm(curproc->pgdir, sz, sz + 2*PGSIZE)) == 0) 
-    return 0;
 
-  acquire(&ptable.lock);
+  acquire(&curproc->lock);
   if((t = allocthread(curproc)) == 0) {
-    deallocuvm(curproc->pgdir, sz + 2*PGSIZE, sz);
-    release(&ptable.lock);
+    release(&curproc->lock);
     return 0;
   }
 
-  curproc->sz = sz;
-  sp = sz;
+  // Reuse the stack of the joined thread t was, or else
+  // grow the process by two pages for a new one, giving up
+  // idle stacks first if short of memory, as growproc does.
+  if(t->ustack == 0){
+    sz = PGROUNDUP(curproc->sz);
+    if(allocuvm(curproc->pgdir, sz, sz + 2*PGSIZE) == 0){
+      if(!reclaimstacks(curproc))
+        goto bad;
+      sz = PGROUNDUP(curproc->sz);
+      if(allocuvm(curproc->pgdir, sz, sz + 2*PGSIZE) == 0)
+        goto bad;
+    }
+    curproc->sz = sz + 2*PGSIZE;
+    t->ustack = curproc->sz;
+  }
+  sp = t->ustack;
 
   sp -= 4;
   *(uint*)sp = (uint)arg;
@@ -321,30 +698,47 @@ thread_create(thread_t *thread, void *start_routine, void *arg)
   *t->tf = *curthread->tf;
   t->tf->eip = (uint)start_routine;
   t->tf->esp = (uint)sp;
+  t->priority = curthread->priority;
+  t->affinity = curthread->affinity;
+  t->rtprio = curthread->rtprio;
   *thread = t->tid;
 
   switchuvm(curproc, curthread);
-  t->state = RUNNABLE;
+  setrunnable(t);
   
-  release(&ptable.lock);
+  release(&curproc->lock);
 
   return t;
+
+bad:
+  kfree(t->kstack);
+  t->kstack = 0;
+  t->state = UNUSED;
+  curproc->threadcnt--;
+  switchuvm(curproc, curthread);  // reclaimstacks may have unmapped pages
+  release(&curproc->lock);
+  return 0;
 }
 
 void
 thread_exit(void *retval)
 {
   struct thread *curthread = mythread();
+  struct thread *t;
 
-  acquire(&ptable.lock);
+  acquire(&curthread->proc->lock);
 
-  // other threads might be sleeping in thread_join().
-  wakeup2(curthread->proc);
+  // Joiners sleep on the thread itself.  Switch straight
+  // to one of them rather than leave it to wait its turn
+  // wherever it last ran.
+  if((t = wakeup2(curthread)) != 0 && handoff(t) < 0)
+    t = 0;
 
+  deactivate(curthread);
   curthread->state = ZOMBIE;
   curthread->retval = retval;
 
-  sched();
+  schedto(t);
   panic("zombie thread exit");
 }
 
@@ -355,36 +749,99 @@ thread_join(thread_t thread, void **retval)
   struct proc *curproc = curthread->proc;
   struct thread *t;
   
-  acquire(&ptable.lock);
-  for(;;){
-    for(t = curproc->threads; t < &curproc->threads[NTHREAD]; t++){
-      if(t->state == ZOMBIE && t->tid == thread) {
-        *retval = t->retval;
-        t->retval = 0;
-
-        kfree(t->kstack);
-        t->kstack = 0;
-        t->state = UNUSED;
-        curproc->threadcnt--;
-        release(&ptable.lock);
-        return 0;
-      }
-    }
+  acquire(&curproc->lock);
+  for(t = curproc->threads; t != 0; t = t->pnext)
+    if(t->tid == thread && t->state != UNUSED && t != curthread)
+      break;
+  if(t == 0){
+    release(&curproc->lock);
+    return -1;
+  }
 
-    // No point waiting if we don't have any children.
-    if(curproc->killed){
-      release(&ptable.lock);
+  // Wait on the thread itself, so that only its own
+  // thread_exit() wakes us.  Give up if another joiner
+  // reaped it first.
+  while(t->state != ZOMBIE){
+    if(curproc->killed || t->tid != thread || t->state == UNUSED){
+      release(&curproc->lock);
       return -1;
     }
-
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    sleep2(curproc, &ptable.lock);  //DOC: wait-sleep
+    sleep2(t, &curproc->lock);  //DOC: wait-sleep
   }
+
+  *retval = t->retval;
+  t->retval = 0;
+
+  kfree(t->kstack);
+  t->kstack = 0;
+  t->state = UNUSED;
+  curproc->threadcnt--;
+  release(&curproc->lock);
+  return 0;
+}
+
+// Make base the start of the calling thread's %gs segment,
+// for thread-local storage.  Each thread has its own base;
+// new threads start with 0, and fork copies it.  The segment
+// itself is set per CPU on every switch, see switchthread.
+int
+settls(uint base)
+{
+  struct thread *curthread = mythread();
+  struct proc *curproc = curthread->proc;
+
+  // switchthread reads pggen, which is changed under the
+  // proc lock.
+  acquire(&curproc->lock);
+  curthread->tls = base;
+  curthread->tf->gs = (SEG_UTLS << 3) | DPL_USER;
+  switchthread(curproc, curthread);
+  release(&curproc->lock);
+  return 0;
+}
+
+// Undo allocproc() for a fork that failed.
+static void
+freeproc(struct proc *p)
+{
+  acquire(&ptable.lock);
+  freethreads(p);
+  p->threadcnt = 0;
+  p->pid = 0;
+  release(&ptable.lock);
+}
+
+// Make nt, a new thread of the child, a copy of ot, in the
+// same place in every scheduling class: priority, real-time
+// priority, affinity, MLFQ level and pass.  Only the time
+// slice and the statistics start afresh.
+// Called with both procs' locks held.
+static void
+forkthread(struct thread *nt, struct thread *ot)
+{
+  *nt->tf = *ot->tf;
+
+  // Clear %eax so that fork returns 0 in the child.
+  nt->tf->eax = 0;
+  nt->priority = ot->priority;
+  nt->rtprio = ot->rtprio;
+  nt->affinity = ot->affinity;
+  nt->qlevel = ot->qlevel;
+  nt->epoch = ot->epoch;
+  nt->pass = ot->pass;
+  nt->ustack = ot->ustack;
+  nt->tls = ot->tls;
+
+  if(ot->state == RUNNING || ot->state == RUNNABLE)
+    setrunnable(nt);
+  else
+    nt->state = ot->state;
 }
 
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
-// Caller must set state of returned proc to RUNNABLE.
+// The child gets a thread, and so a kernel stack, only for
+// each thread of ours that exists.
 int
 fork(void)
 {
@@ -395,55 +852,67 @@ fork(void)
   struct proc *curproc = curthread->proc;
   struct thread *ot;
 
-  // Allocate process.
-  if((np = allocproc(NTHREAD)) == 0){
+  // Allocate process.  Its first thread will be the copy of
+  // the calling thread.
+  if((np = allocproc(1)) == 0){
     return -1;
   }
 
+  // Copy process state from proc.
+  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+    freeproc(np);
+    return -1;
+  }
+  np->sz = curproc->sz;
+
+  // Allocate the other threads under both locks, so that
+  // none of ours come or go until they are all copied.
+  acquire(&curproc->lock);
+  acquire(&np->lock);
+  for(ot = curproc->threads; ot != 0; ot = ot->pnext){
+    if(ot != curthread && ot->state != UNUSED && allocthread(np) == 0){
+      release(&np->lock);
+      release(&curproc->lock);
+      freevm(np->pgdir);
+      freeproc(np);
+      return -1;
+    }
+  }
+
   np->parent = curthread;
+  np->acct = curproc->acct;
 
   for(i = 0; i < NOFILE; i++)
     if(curproc->ofile[i])
       np->ofile[i] = filedup(curproc->ofile[i]);
 
   np->cwd = idup(curproc->cwd);
-  np->threadcnt = curproc->threadcnt;
-  
+
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    for(nt = np->threads; nt < &np->threads[NTHREAD]; nt++){
-      kfree(nt->kstack);
-      nt->kstack = 0;
-      nt->state = UNUSED;
+  nt = np->threads;
+  forkthread(nt, curthread);
+  for(ot = curproc->threads; ot != 0; ot = ot->pnext){
+    if(ot != curthread && ot->state != UNUSED){
+      nt = nt->pnext;
+      forkthread(nt, ot);
     }
-    return -1;
   }
-  np->sz = curproc->sz;
 
-  for(nt = np->threads, ot = curproc->threads; nt < &np->threads[NTHREAD]; nt++, ot++) {
-    if(ot->state == UNUSED) {
-      kfree(nt->kstack);
-      nt->kstack = 0;
-    }
-    *nt->tf = *ot->tf;
-
-    // Clear %eax so that fork returns 0 in the child.
-    nt->tf->eax = 0;
-
-    if(ot->state == RUNNING) {
-      acquire(&ptable.lock);
-
-      nt->state = RUNNABLE;
-
-      release(&ptable.lock);
-    } else {
-      nt->state = ot->state;
+  // copyuvm copied the idle stacks of joined threads too, so
+  // keep them for the child's thread_create to reuse.  If
+  // the pool runs dry, the rest stay mapped but unused.
+  for(ot = curproc->threads; ot != 0; ot = ot->pnext){
+    if(ot->state == UNUSED && ot->ustack){
+      if(takethread(np, &nt->pnext) == 0)
+        break;
+      nt = nt->pnext;
+      nt->ustack = ot->ustack;
     }
   }
-  
-  np->threadcnt = curproc->threadcnt;
+  release(&np->lock);
+  release(&curproc->lock);
+
   pid = np->pid;
 
   return pid;
@@ -456,13 +925,45 @@ isinitproc(struct proc *proc)
   return 0;
 }
 
+// Hurry the other threads of p, exiting, on their way out:
+// each must run until it finds p killed and stops itself in
+// exit(), so that none is left holding a lock or a log
+// operation.  Sleepers are woken, as kill() does, and
+// threads running on other CPUs interrupted.  Returns the
+// number not stopped yet.  Called with p's lock held.
+static int
+stopthreads(struct proc *p)
+{
+  struct thread *t;
+  int n;
+
+  n = 0;
+  for(t = p->threads; t != 0; t = t->pnext){
+    if(t == p->exiter || t->state == UNUSED || t->state == ZOMBIE)
+      continue;
+    if(t->state == SLEEPING || t->state == THREAD_SLEEPING){
+      wqremove(t);
+      setrunnable(t);
+    } else if(t->state == RUNNING)
+      lapicipi(cpus[t->cpu].apicid, T_RESCHED);
+    n++;
+  }
+  return n;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
+// The first thread to get here stops the others and waits
+// for them to switch out, since wait() frees their kernel
+// stacks and the page table they run on.  The others, sent
+// here from trap() once they find the process killed, only
+// stop.
 void
 exit(void)
 {
-  struct proc *curproc = myproc();
+  struct thread *curthread = mythread();
+  struct proc *curproc = curthread->proc;
   struct proc *p;
   struct thread *t;
   int iszombie;
@@ -471,6 +972,25 @@ exit(void)
   if(curproc == initproc)
     panic("init exiting");
 
+  acquire(&curproc->lock);
+  if(curproc->exiter){
+    deactivate(curthread);
+    curthread->state = ZOMBIE;
+    sched();
+    panic("zombie exit");
+  }
+  curproc->exiter = curthread;
+  curproc->killed = 1;
+  // Look again every tick until they have all stopped.
+  while(stopthreads(curproc)){
+    release(&curproc->lock);
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+    acquire(&curproc->lock);
+  }
+  release(&curproc->lock);
+
   // Close all open files.
   for(fd = 0; fd < NOFILE; fd++){
     if(curproc->ofile[fd]){
@@ -486,27 +1006,33 @@ exit(void)
 
   acquire(&ptable.lock);
 
-  // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
+  // Parent might be sleeping in wait().  It can't look at
+  // our threads before we have released ptable.lock, and
+  // after that it needs our proc lock, which sched() only
+  // lets go once we are off this CPU.
+  wakeup(curproc->parent);
 
   // Pass abandoned children to init. 
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent->proc == curproc){
-      p->parent = &initproc->threads[0];
+    if(p->parent && p->parent->proc == curproc){
+      p->parent = initproc->threads;
       iszombie = 1;
-      for(t = p->threads; t < &p->threads[NTHREAD]; t++)
+      acquire(&p->lock);
+      for(t = p->threads; t != 0; t = t->pnext)
         if(t->state != ZOMBIE && t->state != UNUSED)
           iszombie = 0;
+      release(&p->lock);
       
       if(p->threadcnt != 0 && iszombie)
-        wakeup1(initproc);
+        wakeup(p->parent);
     }
   }
 
   // Jump into the scheduler, never to return.
-  for(t = curproc->threads; t < &curproc->threads[NTHREAD]; t++) 
-    if(t->state != UNUSED)
-      t->state = ZOMBIE;
+  acquire(&curproc->lock);
+  release(&ptable.lock);
+  deactivate(curthread);
+  curthread->state = ZOMBIE;
 
   sched();
   panic("zombie exit");
@@ -532,34 +1058,33 @@ wait(void)
         continue;
       havekids = 1;
       iszombie = 1;
-      for(t = p->threads; t < &p->threads[NTHREAD]; t++) {
+      // Threads only turn ZOMBIE themselves, under p's lock,
+      // and hold it until they are switched out (see exit),
+      // so taking it also waits for the last one to be off
+      // its stack before the stack is freed.
+      acquire(&p->lock);
+      for(t = p->threads; t != 0; t = t->pnext) {
         if(t->state != UNUSED && t->state != ZOMBIE){
           iszombie = 0;
         }
       }
 
       if(p->threadcnt != 0 && iszombie) {
-        for(t = p->threads; t < &p->threads[NTHREAD]; t++) {
-          if(t->state == ZOMBIE) {
-            kfree(t->kstack);
-            t->kstack = 0;
-            t->state = UNUSED;
-          }
-        }
-
+        freethreads(p);
         freevm(p->pgdir);
+        p->pggen++;
         pid = p->pid;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
+        p->exiter = 0;
         p->threadcnt = 0;
-        p->qlevel = 0;
-        p->priority = 0;
-        p->usedtq = 0;
+        release(&p->lock);
         release(&ptable.lock);
         return pid;
       }
+      release(&p->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -568,314 +1093,982 @@ wait(void)
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    // Wait for children to exit.  (See wakeup call in exit.)
     sleep(curthread, &ptable.lock);  //DOC: wait-sleep
   }
 }
 
-//PAGEBREAK: 42
-// Per-CPU process scheduler.
-// Each CPU calls scheduler() after setting itself up.
-// Scheduler never returns.  It loops, doing:
-//  - choose a process to run
-//  - swtch to start running that process
-//  - eventually that process transfers control
-//      via swtch back to the scheduler.
-	
-void
-scheduler(void)
+//PAGEBREAK: 30
+// Run queues.  rqpush/rqunlink must be called with the
+// queue's lock held; the rest take it themselves.
+
+// Take the proc lock of the queued thread t so it can be
+// run, unless it is cur's, which the caller already holds.
+// Never spins: the lock may be held by a CPU that is still
+// switching t out, or by a CPU that holds cur's lock and
+// wants ours.
+static int
+claim(struct thread *t, struct proc *cur)
 {
-  struct proc *p;
-  struct thread *t;
-  // struct proc *tempp;
-  // struct thread *tempt;
-  struct cpu *c = mycpu();
-  c->proc = 0;
-  c->thread = 0;
- 
-// Multilevel scheduler
-#if SCHED_POLICY == MULTILEVEL_SCHED
-  // int even_flag = 0;
-  // for(;;){
-  //   // Enable interrupts on this processor.
-  //   sti();
-
-  //   // Loop over process table looking for process to run.
-  //   acquire(&ptable.lock);
-  //   even_flag = 0;
-  //   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-  //     if(p->pid % 2 != 0 || p->state != RUNNABLE) continue;
-
-  //     // Switch to chosen process.  It is the process's job
-  //     // to release ptable.lock and then reacquire it
-  //     // before jumping back to us.
-
-  //     even_flag = 1;
-
-  //     c->proc = p;
-  //     //TODO: c->thread = t;
-  //     switchuvm(p);
-  //     p->state = RUNNING;
-
-  //     swtch(&(c->scheduler), p->context);
-  //     switchkvm();
-
-  //     // Process is done running for now.
-  //     // It should have changed its p->state before coming back.
-  //     c->proc = 0;
-  //     c->thread = 0;
-  //   }
-
-  //   if (even_flag != 0) {
-  //     release(&ptable.lock);
-  //     continue;
-  //   }
-
-  //   struct proc* minproc;
-  //   int foundmin = 0;
-
-  //   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-  //     if(p->pid % 2 == 0 || p->state != RUNNABLE) continue;
-  //     if(!foundmin) {
-  //       minproc = p;
-	// foundmin = 1;
-  //     }
-  //     if(p->pid < minproc->pid) minproc = p;
-  //   }
-
-  //   if (!foundmin) {
-  //     release(&ptable.lock);
-  //     continue;
-  //   }
-
-  //   c->proc = minproc;
-  //   //TODO: c->thread = t;
-  //   switchuvm(minproc);
-  //   minproc->state = RUNNING;
-
-  //   swtch(&(c->scheduler), minproc->context);
-  //   switchkvm();
-
-  //   c->proc = 0;
-  //   //TODO: c->thread = t;
-  //   release(&ptable.lock);
-  // }
+  return t->proc == cur || tryacquire(&t->proc->lock);
+}
 
-// MLFQ scheduler
-#elif SCHED_POLICY == MLFQ_SCHED
-  // for(;;){
-  //   sti();
-
-  //   acquire(&ptable.lock);
-  //   for(int i = 0; i < MLFQ_K; i++) {
-  //     int maxtq = i * 4 + 2;
-
-  //     // vip: selected process to run
-  //     struct proc *vip = 0;
-
-  //     // if current level queue has running process
-  //     if (ptable.runningproc[i] != 0 && ptable.runningproc[i]->state == RUNNABLE) {
-        
-	// // if time quantum has overed
-  //       if(ptable.runningproc[i]->usedtq < maxtq) vip = ptable.runningproc[i];
-	// else {
-  //         ptable.runningproc[i]->qlevel++;
-	//   ptable.runningproc[i]->usedtq = 0;
-	//   ptable.runningproc[i] = 0;
-	// }
-  //     }
-
-  //     // if current level queue doesn't have running process
-  //     if(!vip) {
-  //       for(p = ptable.proc; p < &ptable.proc[NPROC]; p++) {
-  //         if(p->state != RUNNABLE || p->qlevel != i) continue;
-  // 	  if(!vip) {
-  //           vip = p;
-  // 	  }
-	//   else if(vip->priority < p->priority) vip = p;
-  //       }
-  //     }
-
-  //     // if cannot find process to run, move to next queue
-  //     if(!vip) continue;
-
-  //     ptable.runningproc[i] = vip;
-  //     c->proc = vip;
-  //     //TODO: c->thread=t;
-  //     switchuvm(vip);
-  //     vip->state = RUNNING;
-
-  //     swtch(&(c->scheduler), vip->context);
-  //     switchkvm();
-
-  //     c->proc = 0;
-  //     c->thread = 0;
-  //     break;
-  //   }
-  //   release(&ptable.lock);
-  // }
+// Run queue slots are FIFO lists, most urgent slot first.
+// Link t into slot i ahead of before, or at the tail of the
+// slot if before is 0.
+static void
+slotinsert(struct runq *rq, int i, struct thread *t, struct thread *before)
+{
+  t->rqidx = i;
+  t->rqnext = before;
+  if(before){
+    t->rqprev = before->rqprev;
+    before->rqprev = t;
+  } else {
+    t->rqprev = rq->tail[i];
+    rq->tail[i] = t;
+  }
+  if(t->rqprev)
+    t->rqprev->rqnext = t;
+  else
+    rq->head[i] = t;
+}
 
-// default scheduler (round robin)
-#else
-  for(;;){
+static void
+slotunlink(struct runq *rq, struct thread *t)
+{
+  int i = t->rqidx;
+
+  if(t->rqprev)
+    t->rqprev->rqnext = t->rqnext;
+  else
+    rq->head[i] = t->rqnext;
+  if(t->rqnext)
+    t->rqnext->rqprev = t->rqprev;
+  else
+    rq->tail[i] = t->rqprev;
+  t->rqnext = t->rqprev = 0;
+}
 
-    sti();
+// Unlink and return the first thread in slots lo..hi whose
+// proc lock could be taken, or 0.
+static struct thread*
+slotpick(struct runq *rq, int lo, int hi, struct proc *cur)
+{
+  struct thread *t;
+  int i;
 
-    acquire(&ptable.lock); 
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      for(t = p->threads; t < &p->threads[NTHREAD]; t++) {
-        if(t->state != RUNNABLE) continue;
-
-        c->proc = p;
-        c->thread = t;
-        switchuvm(p, t);
-        t->state = RUNNING;
-
-        
-    // for(tempp = ptable.proc; tempp < &ptable.proc[NPROC]; tempp++){
-    //   if(tempp->pid < 3) continue;
-    //   cprintf("%d: ", tempp->pid);
-    //   for(tempt = tempp->threads; tempt < &tempp->threads[NTHREAD]; tempt++) {
-    //     cprintf("%d %d %d / ", tempt->state, tempt->tf->eip, tempt->tf->esp);
-    //   }
-    //   cprintf("\n");
-    // }
-
-        swtch(&(c->scheduler), t->context);
-        switchkvm();
-
-        c->proc = 0;
-        c->thread = 0;
+  for(i = lo; i <= hi; i++){
+    for(t = rq->head[i]; t != 0; t = t->rqnext){
+      if(claim(t, cur)){
+        slotunlink(rq, t);
+        return t;
       }
     }
-    release(&ptable.lock);
   }
-#endif
+  return 0;
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
-// intena because intena is a property of this
-// kernel thread, not this CPU. It should
-// be proc->intena and proc->ncli, but that would
-// break in the few places where a lock is held but
-// there's no process.
-void
-sched(void)
+// Thread queued before t in slots lo..hi in steal() order
+// (tail to head, least urgent slot first), or the last one
+// if t is 0.
+static struct thread*
+slotprev(struct runq *rq, struct thread *t, int lo, int hi)
 {
-  int intena;
-  struct thread *t = mythread();
+  int i;
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
-  if(mycpu()->ncli != 1)
-    panic("sched locks");
-  if(t->state == RUNNING)
-    panic("sched running");
-  if(readeflags()&FL_IF)
-    panic("sched interruptible");
-  intena = mycpu()->intena;
-  swtch(&t->context, mycpu()->scheduler);
-  mycpu()->intena = intena;
+  if(t && t->rqprev)
+    return t->rqprev;
+  for(i = t ? t->rqidx - 1 : hi; i >= lo; i--)
+    if(rq->tail[i])
+      return rq->tail[i];
+  return 0;
 }
 
-// Give up the CPU for one scheduling round.
-void
-yield(void)
+// Classes that file their threads in the slots after the
+// real-time ones, by their slot op.
+static void
+listenqueue(struct runq *rq, struct thread *t, int athead)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  mythread()->state = RUNNABLE;
-  sched();
-  release(&ptable.lock);
+  int i = sclass->slot(t);
+
+  slotinsert(rq, i, t, athead ? rq->head[i] : 0);
 }
 
-// A fork child's very first scheduling by scheduler()
-// will swtch here.  "Return" to user space.
-void
-forkret(void)
+static struct thread*
+listpick(struct runq *rq, struct proc *cur)
 {
-  static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  return slotpick(rq, NRTQ, NRUNQ-1, cur);
+}
 
-  if(first) {
-    // Some initialization functions must be run in the context
-    // of a regular process (e.g., they call sleep), and thus cannot
-    // be run from main().
-    first = 0;
-    iinit(ROOTDEV);
-    initlog(ROOTDEV);
+// Is any thread queued on rq in a slot ahead of idx?  The
+// classes' urgent ops pass their own slot for the running
+// thread: they are called without the run queue locks, so
+// sclass may have changed under them.  Racy peek, see
+// increasetq.
+static int
+listurgent(struct runq *rq, int idx)
+{
+  int i;
+
+  for(i = NRTQ; i < idx; i++)
+    if(rq->head[i])
+      return 1;
+  return 0;
+}
+
+static struct thread*
+listprev(struct runq *rq, struct thread *t)
+{
+  return slotprev(rq, t, NRTQ, NRUNQ-1);
+}
+
+// Round robin: one slot, and every tick ends a turn.
+static int
+rrslot(struct thread *t)
+{
+  return NRTQ;
+}
+
+static int
+rrtick(struct thread *t)
+{
+  return 1;
+}
+
+static int
+rrurgent(struct runq *rq, struct thread *t)
+{
+  return listurgent(rq, rrslot(t));
+}
+
+// MLFQ files threads by level and, within a level, by
+// priority, so that the first non-empty slot always holds
+// the next thread to run.
+static int
+mlfqslot(struct thread *t)
+{
+  return NRTQ + t->qlevel * (MAXPRIO+1) + (MAXPRIO - t->priority);
+}
+
+static int
+mlfqurgent(struct runq *rq, struct thread *t)
+{
+  return listurgent(rq, mlfqslot(t));
+}
+
+// Yield only once the quantum of t's level is used up or
+// a more urgent thread is waiting on this CPU.
+static int
+mlfqtick(struct thread *t)
+{
+  return t->usedtq >= MLFQ_TQ(t->qlevel) || rqurgent(&runqs[t->cpu], t);
+}
+
+// Catch rq up with the latest priority boost: move every
+// thread queued below level 0 to the tail of its level-0
+// slot, in level order, and drop the per-level time slices
+// of rq's CPU.  A thread can sit below level 0 with the
+// current epoch already, if it was caught up while running
+// and then demoted, so each one is boosted regardless;
+// otherwise it would be queued in the same slot again and
+// the loop would never end.
+static void
+mlfqboost(struct runq *rq)
+{
+  struct thread *t;
+  int i;
+
+  rq->epoch = ptable.boostepoch;
+  for(i = 0; i < MLFQ_K; i++)
+    ptable.runningthread[rq - runqs][i] = 0;
+  for(i = NRTQ + MAXPRIO+1; i < NRUNQ; i++){
+    while((t = rq->head[i]) != 0){
+      rqunlink(rq, t);
+      boostthread(t);
+      rqpush(rq, t, 0);
+    }
   }
+}
 
-  // Return to "caller", actually trapret (see allocproc).
+// Multilevel: threads of even pids run first, round robin.
+// Only when none is runnable do threads of odd pids run,
+// lowest pid first and without time slicing.
+static int
+mlslot(struct thread *t)
+{
+  return NRTQ + t->proc->pid % 2;
 }
 
-// Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
+static void
+mlenqueue(struct runq *rq, struct thread *t, int athead)
+{
+  struct thread *q;
+
+  if(t->proc->pid % 2 == 0){
+    listenqueue(rq, t, athead);
+    return;
+  }
+  for(q = rq->head[NRTQ+1]; q != 0; q = q->rqnext)
+    if(q->proc->pid > t->proc->pid)
+      break;
+  slotinsert(rq, NRTQ+1, t, q);
+}
+
+static int
+mlurgent(struct runq *rq, struct thread *t)
+{
+  struct thread *q;
+
+  if(t->proc->pid % 2 == 0)
+    return 0;
+  if(rq->head[NRTQ])
+    return 1;
+  q = rq->head[NRTQ+1];
+  return q != 0 && q->proc->pid < t->proc->pid;
+}
+
+static int
+mltick(struct thread *t)
+{
+  return t->proc->pid % 2 == 0 || mlurgent(&runqs[t->cpu], t);
+}
+
+// The stride and fair-share classes keep their threads on
+// the pass heap.
+static void
+heapswap(struct runq *rq, int i, int j)
+{
+  struct thread *t = rq->heap[i];
+
+  rq->heap[i] = rq->heap[j];
+  rq->heap[j] = t;
+  rq->heap[i]->rqidx = i;
+  rq->heap[j]->rqidx = j;
+}
+
+static void
+siftup(struct runq *rq, int i)
+{
+  while(i > 0 && PASSLESS(rq->heap[i], rq->heap[(i-1)/2])){
+    heapswap(rq, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void
+siftdown(struct runq *rq, int i)
+{
+  int c;
+
+  while((c = 2*i+1) < rq->nheap){
+    if(c+1 < rq->nheap && PASSLESS(rq->heap[c+1], rq->heap[c]))
+      c++;
+    if(!PASSLESS(rq->heap[c], rq->heap[i]))
+      break;
+    heapswap(rq, i, c);
+    i = c;
+  }
+}
+
+// A thread that slept or is new must not bank the time it
+// was away: its pass starts no lower than the queue's.
+static void
+heapenqueue(struct runq *rq, struct thread *t, int athead)
+{
+  if((int)(t->pass - rq->vpass) < 0)
+    t->pass = rq->vpass;
+  t->rqidx = rq->nheap++;
+  rq->heap[t->rqidx] = t;
+  siftup(rq, t->rqidx);
+}
+
+static void
+heapdequeue(struct runq *rq, struct thread *t)
+{
+  int i = t->rqidx;
+
+  rq->nheap--;
+  if(i != rq->nheap){
+    rq->heap[i] = rq->heap[rq->nheap];
+    rq->heap[i]->rqidx = i;
+    siftdown(rq, i);
+    siftup(rq, i);
+  }
+  rq->heap[rq->nheap] = 0;
+}
+
+// The claimable thread with the smallest pass.
+static struct thread*
+heappick(struct runq *rq, struct proc *cur)
+{
+  struct thread *t;
+  int i;
+
+  for(i = 0; i < rq->nheap; i++){
+    if(claim(rq->heap[i], cur)){
+      t = rq->heap[i];
+      heapdequeue(rq, t);
+      if(i == 0)
+        rq->vpass = t->pass;
+      return t;
+    }
+  }
+  return 0;
+}
+
+// Does some thread waiting on rq have a smaller pass than t?
+// Racy peek, see increasetq.
+static int
+heapurgent(struct runq *rq, struct thread *t)
+{
+  struct thread *first = rq->heap[0];
+
+  return first != 0 && PASSLESS(first, t);
+}
+
+// From the end of the heap array.
+static struct thread*
+heapprev(struct runq *rq, struct thread *t)
+{
+  int i = t ? t->rqidx - 1 : rq->nheap - 1;
+
+  return i >= 0 ? rq->heap[i] : 0;
+}
+
+static int
+stridetick(struct thread *t)
+{
+  t->pass += STRIDE1 / TICKETS(t);
+  return rqurgent(&runqs[t->cpu], t);
+}
+
+static int
+fairtick(struct thread *t)
+{
+  t->pass += FAIRSTRIDE(t);
+  return rqurgent(&runqs[t->cpu], t);
+}
+
+static struct schedclass classes[] = {
+[RR_SCHED]         { "rr", rrslot, listenqueue, slotunlink, listpick,
+                     rrtick, 0, 0, rrurgent, listprev },
+[MULTILEVEL_SCHED] { "multilevel", mlslot, mlenqueue, slotunlink, listpick,
+                     mltick, 0, 0, mlurgent, listprev },
+[MLFQ_SCHED]       { "mlfq", mlfqslot, listenqueue, slotunlink, listpick,
+                     mlfqtick, mlfqboost, mlfqkeep, mlfqurgent, listprev },
+[STRIDE_SCHED]     { "stride", 0, heapenqueue, heapdequeue, heappick,
+                     stridetick, 0, 0, heapurgent, heapprev },
+[FAIRSHARE_SCHED]  { "fairshare", 0, heapenqueue, heapdequeue, heappick,
+                     fairtick, 0, 0, heapurgent, heapprev },
+};
+
+static struct schedclass *sclass = &classes[SCHED_POLICY];
+
+// Real-time threads are queued in the first NRTQ slots
+// whatever the class.
+static void
+rqpush(struct runq *rq, struct thread *t, int athead)
+{
+  int i;
+
+  if(t->rtprio){
+    i = MAXRTPRIO - t->rtprio;
+    slotinsert(rq, i, t, athead ? rq->head[i] : 0);
+  } else
+    sclass->enqueue(rq, t, athead);
+  rq->nrunnable++;
+}
+
+static void
+rqunlink(struct runq *rq, struct thread *t)
+{
+  if(t->rtprio)
+    slotunlink(rq, t);
+  else
+    sclass->dequeue(rq, t);
+  rq->nrunnable--;
+}
+
+// Should the running thread t give way to a thread queued
+// on rq?  A real-time thread only gives way to a higher
+// real-time priority; the others to any real-time thread,
+// and otherwise as the class says.  Racy peek, see
+// increasetq.
+static int
+rqurgent(struct runq *rq, struct thread *t)
+{
+  struct schedclass *sc = sclass;
+  int i, idx;
+
+  idx = t->rtprio ? MAXRTPRIO - t->rtprio : NRTQ;
+  for(i = 0; i < idx; i++)
+    if(rq->head[i])
+      return 1;
+  return !t->rtprio && sc->urgent(rq, t);
+}
+
+// Remove and return the next thread to run whose proc lock
+// could be taken (see claim), or 0: real-time threads first,
+// then whatever the class picks.
+static struct thread*
+rqpop(struct runq *rq, struct proc *cur)
+{
+  struct thread *t;
+
+  acquire(&rq->lock);
+  if(sclass->boost && rq->epoch != ptable.boostepoch)
+    sclass->boost(rq);
+  if((t = slotpick(rq, 0, NRTQ-1, cur)) == 0)
+    t = sclass->pick_next(rq, cur);
+  if(t)
+    rq->nrunnable--;
+  release(&rq->lock);
+  return t;
+}
+
+// Thread queued on rq before t in steal() order, least
+// urgent first, or the last one if t is 0: the class's
+// threads, then the real-time slots.
+static struct thread*
+rqprevof(struct runq *rq, struct thread *t)
+{
+  struct thread *u;
+
+  if(t == 0 || !t->rtprio){
+    if((u = sclass->prev(rq, t)) != 0)
+      return u;
+    t = 0;
+  }
+  return slotprev(rq, t, 0, NRTQ-1);
+}
+
+// CPU with the fewest runnable threads among those t may
+// run on, for placing a thread that has never run or whose
+// affinity no longer includes its CPU.
+static int
+idlestcpu(struct thread *t)
+{
+  int i, best;
+
+  best = -1;
+  for(i = 0; i < ncpu; i++){
+    if(!CANRUN(t, i))
+      continue;
+    if(best < 0 || runqs[i].nrunnable < runqs[best].nrunnable)
+      best = i;
+  }
+  return best;
+}
+
+// Most loaded run queue with at least two more threads
+// than rq, or with any thread at all if rq is empty.
+// The peek is racy; steal() rechecks under the locks.
+static struct runq*
+busiest(struct runq *rq)
+{
+  struct runq *q, *best;
+
+  best = 0;
+  for(q = runqs; q < &runqs[ncpu]; q++){
+    if(q == rq || q->nrunnable == 0)
+      continue;
+    if(rq->nrunnable > 0 && q->nrunnable < rq->nrunnable + 2)
+      continue;
+    if(best == 0 || q->nrunnable > best->nrunnable)
+      best = q;
+  }
+  return best;
+}
+
+// Move t from victim's queue to rq's.  Both locks held.
+static void
+migrate(struct runq *rq, struct runq *victim, struct thread *t)
+{
+  rqunlink(victim, t);
+  // Keep t's distance from the virtual time of its queue.
+  t->pass = t->pass - victim->vpass + rq->vpass;
+  t->cpu = rq - runqs;
+  catchup(t);
+  rqpush(rq, t, 0);
+}
+
+// Move up to n threads from the tail of victim to rq,
+// least urgent first.  Cache-hot threads stay put unless
+// rq is empty and nothing cold was found; threads pinned
+// away from rq's CPU always stay put.
+static int
+steal(struct runq *rq, struct runq *victim, int n)
+{
+  struct runq *first, *second;
+  struct thread *t, *prev, *hot;
+  int moved, idle, cpu;
+
+  first = rq < victim ? rq : victim;
+  second = rq < victim ? victim : rq;
+  acquire(&first->lock);
+  acquire(&second->lock);
+
+  moved = 0;
+  hot = 0;
+  idle = rq->nrunnable == 0;
+  cpu = rq - runqs;
+  for(t = rqprevof(victim, 0); t != 0 && moved < n; t = prev){
+    prev = rqprevof(victim, t);
+    if(!CANRUN(t, cpu))
+      continue;
+    if(ticks - t->lastran < MIGRATE_HOT){
+      if(hot == 0)
+        hot = t;
+      continue;
+    }
+    migrate(rq, victim, t);
+    moved++;
+  }
+  if(moved == 0 && idle && hot){
+    migrate(rq, victim, hot);
+    moved++;
+  }
+  rq->stat.nsteal += moved;
+
+  release(&second->lock);
+  release(&first->lock);
+  return moved;
+}
+
+// Even out the load between rq and the busiest other
+// CPU by stealing half the difference.
+static void
+balance(struct runq *rq)
+{
+  struct runq *victim;
+  int n;
+
+  rq->lastbalance = ticks;
+  if((victim = busiest(rq)) == 0)
+    return;
+  n = (victim->nrunnable - rq->nrunnable) / 2;
+  if(n == 0)
+    n = 1;
+  steal(rq, victim, n);
+}
+
+// Mark t RUNNABLE and queue it on the CPU it last ran on,
+// or on the least loaded CPU it may use if it has never
+// run or is no longer allowed on the old one.  athead
+// puts it in front of its slot, to be picked next.
+// t's proc lock must be held.
+static void
+enqueue(struct thread *t, int athead)
+{
+  struct runq *rq;
+
+  if(t->cpu < 0 || t->cpu >= ncpu || !CANRUN(t, t->cpu))
+    t->cpu = idlestcpu(t);
+  rq = &runqs[t->cpu];
+
+  t->state = RUNNABLE;
+  t->enqtime = rdtsc();
+  catchup(t);
+  acquire(&rq->lock);
+  rqpush(rq, t, athead);
+  release(&rq->lock);
+}
+
+// Wake a halted CPU to run t, just queued on its run
+// queue: that CPU itself if it is idle, otherwise any idle
+// CPU t may run on, which will steal it.  A real-time
+// thread must not wait for the next tick behind a busy CPU,
+// so that CPU, even if it is this one, is interrupted to
+// check whether to preempt (see preempt).
+static void
+kick(struct thread *t)
+{
+  struct cpu *c, *me;
+  int cpu;
+
+  me = mycpu();
+  cpu = t->cpu;
+  if(cpus[cpu].idle){
+    if(&cpus[cpu] != me)
+      lapicipi(cpus[cpu].apicid, T_RESCHED);
+    return;
+  }
+  if(t->rtprio){
+    lapicipi(cpus[cpu].apicid, T_RESCHED);
+    return;
+  }
+  for(c = cpus; c < &cpus[ncpu]; c++){
+    if(c != me && c->idle && CANRUN(t, c - cpus)){
+      lapicipi(c->apicid, T_RESCHED);
+      return;
+    }
+  }
+}
+
+// Queue a thread that was not running (new, woken or
+// killed) and make sure some CPU will notice it.
+static void
+setrunnable(struct thread *t)
+{
+  if(t->state != RUNNABLE)
+    activate(t);
+  enqueue(t, 0);
+  kick(t);
+}
+
+// Take a RUNNABLE thread off its run queue because it is
+// leaving that state without being scheduled (e.g. exit).
+// t's proc lock must be held.  steal() may move t to
+// another queue until we hold the lock of the right one.
+static void
+rqremove(struct thread *t)
+{
+  struct runq *rq;
+
+  for(;;){
+    rq = &runqs[t->cpu];
+    acquire(&rq->lock);
+    if(rq == &runqs[t->cpu])
+      break;
+    release(&rq->lock);
+  }
+  rqunlink(rq, t);
+  release(&rq->lock);
+}
+
+// Take the RUNNABLE thread t off its run queue for schedto
+// to switch to on this CPU, whatever else is queued.  Fails
+// if t may not run here.  The caller must hold t's proc
+// lock and be a thread of that proc, so no other CPU can
+// claim t meanwhile.
+static int
+handoff(struct thread *t)
+{
+  if(t->state != RUNNABLE || !CANRUN(t, cpuid()))
+    return -1;
+  rqremove(t);
+  return 0;
+}
+
+// Record how long t waited on its run queue, now that
+// rq's CPU has picked it.
+static void
+account(struct runq *rq, struct thread *t)
+{
+  uint64 wait;
+  int b;
+
+  wait = rdtsc() - t->enqtime;
+  t->waitcycles += wait;
+  wait >>= WAITHIST_SHIFT;
+  for(b = 0; wait && b < NWAITHIST-1; b++)
+    wait >>= 1;
+  rq->stat.waithist[b]++;
+  rq->stat.nswitch++;
+}
+
+// Next thread for rq's CPU to run, or 0, with its proc
+// lock held.  cur is the proc whose lock the caller holds,
+// if any.  Balances first if rq is empty or a balance is due.
+static struct thread*
+pick(struct runq *rq, struct proc *cur)
+{
+  if(rq->nrunnable == 0 || ticks - rq->lastbalance >= BALANCE_TICKS)
+    balance(rq);
+  return rqpop(rq, cur);
+}
+
+// Make t, just picked from rq, the thread running on c:
+// everything short of the swtch into it.
+// t's proc lock must be held.
+static void
+dispatch(struct cpu *c, struct runq *rq, struct thread *t)
+{
+  t->cpu = c - cpus;
+  c->proc = t->proc;
+  c->thread = t;
+  catchup(t);
+  account(rq, t);
+  ptable.runningthread[t->cpu][t->qlevel] = t;
+  switchthread(t->proc, t);
+  t->state = RUNNING;
+}
+
+//PAGEBREAK: 42
+// Per-CPU process scheduler.
+// Each CPU calls scheduler() after setting itself up.
+// Scheduler never returns.  It loops, doing:
+//  - choose a process to run
+//  - swtch to start running that process
+//  - eventually that process transfers control
+//      via swtch back to the scheduler.
+	
 void
-sleep(void *chan, struct spinlock *lk)
+scheduler(void)
+{
+  struct thread *t;
+  struct cpu *c = mycpu();
+  struct runq *rq = &runqs[c - cpus];
+  int stuck = 0;
+  c->proc = 0;
+  c->thread = 0;
+ 
+  for(;;){
+    // Enable interrupts on this processor.
+    sti();
+
+    // With nothing to run or steal, halt until the timer
+    // or a reschedule IPI (see kick).  Announce idle before
+    // the last check so that a concurrent kick is not lost.
+    // An idle CPU takes no locks at all.  stuck means
+    // the last balance found only threads pinned elsewhere;
+    // wait for the next tick before trying again.
+    if(rq->nrunnable == 0 && (stuck || busiest(rq) == 0)){
+      cli();
+      xchg(&c->idle, 1);
+      if(rq->nrunnable == 0 && (stuck || busiest(rq) == 0)){
+        rq->stat.nidle++;
+        stihlt();
+      }
+      c->idle = 0;
+      stuck = 0;
+      continue;
+    }
+
+    if((t = pick(rq, 0)) != 0){
+      // Switch to chosen thread, with its proc lock held.
+      // It is the thread's job to release that lock and
+      // to hold its own again before jumping back to us.
+      // Threads hand the CPU straight to each other in
+      // sched(), so the one that comes back here, once rq
+      // runs dry, need not be t.
+      dispatch(c, rq, t);
+      swtch(&(c->scheduler), t->context);
+      // Threads keep their page table loaded across direct
+      // switches (see switchthread), so this is the only
+      // switchkvm left.  It can't be put off any longer: once
+      // no thread of the process runs here, wait() may free
+      // the page table this CPU would otherwise keep using,
+      // as soon as finishswitch lets go of the proc lock.
+      switchkvm();
+      finishswitch(c);
+
+      // Thread is done running for now.
+      // It should have changed its state before coming back.
+      c->proc = 0;
+      c->thread = 0;
+    } else if(rq->nrunnable == 0)
+      stuck = 1;
+  }
+}
+
+// Count a switch away from t on this CPU: voluntary if t
+// blocked, exited or asked to give up the CPU, involuntary
+// if it was preempted.
+static void
+countswitch(struct thread *t, int involuntary)
 {
+  if(involuntary){
+    t->nivcsw++;
+    runqs[cpuid()].stat.nivcsw++;
+  } else {
+    t->nvcsw++;
+    runqs[cpuid()].stat.nvcsw++;
+  }
+}
+
+// Give up the CPU.  Must hold only the lock of the
+// thread's proc and have changed the thread's state.
+// Switches straight to the next thread on this CPU's run
+// queue, or to itself if it was queued again and is
+// first.  A thread of another proc is only switched to if
+// its lock is free; it then releases ours for us (see
+// finishswitch).  Otherwise scheduler() takes over.
+// Saves and restores intena because intena is a
+// property of this kernel thread, not this CPU. It should
+// be proc->intena and proc->ncli, but that would
+// break in the few places where a lock is held but
+// there's no process.
+void
+sched(void)
+{
+  schedto(0);
+}
+
+// Like sched, but if next is not 0 switch to it, a thread
+// of the same proc taken off its run queue by handoff,
+// without looking at the run queue.
+static void
+schedto(struct thread *next)
+{
+  int intena;
   struct thread *t = mythread();
   struct proc *p = t->proc;
-  
-  if(p == 0)
-    panic("sleep");
+  struct cpu *c;
+  struct runq *rq;
 
-  if(lk == 0)
-    panic("sleep without lk");
+  if(!holding(&p->lock))
+    panic("sched p->lock");
+  if(mycpu()->ncli != 1)
+    panic("sched locks");
+  if(t->state == RUNNING)
+    panic("sched running");
+  if(readeflags()&FL_IF)
+    panic("sched interruptible");
+  // A thread still RUNNABLE was counted by whoever queued
+  // it again; the others blocked or exited.
+  if(t->state != RUNNABLE)
+    countswitch(t, 0);
+  intena = mycpu()->intena;
+  t->lastran = ticks;
+  c = mycpu();
+  rq = &runqs[c - cpus];
+  if(next == 0)
+    next = pick(rq, p);
+  if(next == t)
+    dispatch(c, rq, t);
+  else if(next){
+    if(next->proc != p)
+      c->prevlock = &p->lock;
+    dispatch(c, rq, next);
+    swtch(&t->context, next->context);
+    finishswitch(mycpu());
+  } else {
+    c->prevlock = &p->lock;
+    swtch(&t->context, c->scheduler);
+    finishswitch(mycpu());
+  }
+  mycpu()->intena = intena;
+}
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
+// Called by the context just switched to: release the proc
+// lock that the thread switched away from left held, now
+// that nothing runs on its stack.
+static void
+finishswitch(struct cpu *c)
+{
+  struct spinlock *lk = c->prevlock;
+
+  if(lk){
+    c->prevlock = 0;
     release(lk);
   }
-  // Go to sleep.
-  t->chan = chan;
-  t->state = SLEEPING;
+}
+
+// MLFQ: called when t gives up the CPU.  Returns 1 if t still
+// holds the time slice of its level on this CPU, so it
+// should go back to the head of its queue.  Otherwise t
+// loses the slice, and is demoted if it used up its quantum.
+static int
+mlfqkeep(struct thread *t)
+{
+  struct thread **slice = &ptable.runningthread[cpuid()][t->qlevel];
+
+  if(*slice == t && t->usedtq < MLFQ_TQ(t->qlevel))
+    return 1;
+  if(*slice == t)
+    *slice = 0;
+  if(t->usedtq >= MLFQ_TQ(t->qlevel)){
+    if(t->qlevel < MLFQ_K-1){
+      t->qlevel++;
+      t->ndemote++;
+      runqs[cpuid()].stat.ndemote++;
+    }
+    t->usedtq = 0;
+  }
+  return 0;
+}
 
+// Give up the CPU for one scheduling round.  A real-time
+// thread preempted by a higher priority stays at the head
+// of its slot; one that yields by itself goes to the tail.
+static void
+yieldcpu(int involuntary)
+{
+  struct thread *t = mythread();
+  struct schedclass *sc;
+  int athead;
+
+  acquire(&t->proc->lock);  //DOC: yieldlock
+  // No run queue lock is held, so setschedpolicy may change
+  // sclass at any time: read it once.
+  sc = sclass;
+  if(t->rtprio)
+    athead = rqurgent(&runqs[t->cpu], t);
+  else
+    athead = sc->keep && sc->keep(t);
+  countswitch(t, involuntary);
+  enqueue(t, athead);
   sched();
+  release(&t->proc->lock);
+}
 
-  // Tidy up.
-  t->chan = 0;
+// The running thread asks to give up the CPU.
+void
+yield(void)
+{
+  yieldcpu(0);
+}
 
-  // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+// The running thread is preempted, from trap().
+void
+preemptyield(void)
+{
+  yieldcpu(1);
 }
 
-// Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
+// A fork child's very first scheduling by scheduler()
+// will swtch here.  "Return" to user space.
 void
-sleep2(void *chan, struct spinlock *lk)
+forkret(void)
+{
+  static int first = 1;
+  // Still holding our proc lock from whoever picked us,
+  // and maybe the lock of the thread switched away from.
+  finishswitch(mycpu());
+  release(&myproc()->lock);
+
+  if(first) {
+    // Some initialization functions must be run in the context
+    // of a regular process (e.g., they call sleep), and thus cannot
+    // be run from main().
+    first = 0;
+    iinit(ROOTDEV);
+    initlog(ROOTDEV);
+  }
+
+  // Return to "caller", actually trapret (see allocproc).
+}
+
+// Atomically release lk and sleep on chan in the given
+// state.  Reacquires lk when awakened.
+static void
+sleepstate(void *chan, struct spinlock *lk, enum threadstate state)
 {
   struct thread *t = mythread();
-  
+  struct proc *p;
+
   if(t == 0)
-    panic("thread sleep");
+    panic("sleep");
 
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  // Must acquire p->lock in order to change t->state and
+  // then call sched.  Once t is on its wait queue, a wakeup
+  // that finds it needs p->lock too, and we keep that until
+  // we are switched out, so it's okay to release lk.
+  p = t->proc;
+  if(lk != &p->lock)  //DOC: sleeplock0
+    acquire(&p->lock);  //DOC: sleeplock1
   // Go to sleep.
+  deactivate(t);
   t->chan = chan;
-  t->state = THREAD_SLEEPING;
+  t->state = state;
+  wqinsert(t);
+  if(lk != &p->lock)
+    release(lk);
 
   sched();
 
@@ -883,46 +2076,214 @@ sleep2(void *chan, struct spinlock *lk)
   t->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
+  if(lk != &p->lock){  //DOC: sleeplock2
+    release(&p->lock);
     acquire(lk);
   }
 }
 
+// Atomically release lock and sleep on chan.
+// Reacquires lock when awakened.
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  sleepstate(chan, lk, SLEEPING);
+}
+
+// Like sleep, but a thread sleeping here is only woken by
+// wakeup2 (thread_join).
+void
+sleep2(void *chan, struct spinlock *lk)
+{
+  sleepstate(chan, lk, THREAD_SLEEPING);
+}
+
 //PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Put the sleeping thread t on the wait queue of t->chan.
+// t's proc lock must be held.
 static void
-wakeup1(void *chan)
+wqinsert(struct thread *t)
 {
-  struct proc *p;
-  struct thread *t;
+  struct waitq *wq = &ptable.waitq[WAITQ(t->chan)];
+
+  acquire(&wq->lock);
+  t->wprev = 0;
+  t->wnext = wq->head;
+  if(wq->head)
+    wq->head->wprev = t;
+  wq->head = t;
+  release(&wq->lock);
+}
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    for (t = p->threads; t < &p->threads[NTHREAD]; t++)
-      if(t->state == SLEEPING && t->chan == chan)
-        t->state = RUNNABLE;
+// Unlink t from wq if it is on it.  wq's lock must be held.
+static void
+wqunlink(struct waitq *wq, struct thread *t)
+{
+  if(t->wprev)
+    t->wprev->wnext = t->wnext;
+  else if(wq->head == t)
+    wq->head = t->wnext;
+  else
+    return;
+  if(t->wnext)
+    t->wnext->wprev = t->wprev;
+  t->wnext = t->wprev = 0;
 }
 
+// Take t off its wait queue, if it is on one: a thread
+// copied by fork in a sleeping state never was, and a
+// wakeup may have taken it off already.
+// t's proc lock must be held.
 static void
-wakeup2(void *chan)
+wqremove(struct thread *t)
+{
+  struct waitq *wq = &ptable.waitq[WAITQ(t->chan)];
+
+  acquire(&wq->lock);
+  wqunlink(wq, t);
+  release(&wq->lock);
+}
+
+// Most threads one pass of wakeupstate takes off a wait
+// queue before it goes to lock their procs.
+#define WAKEBATCH 8
+
+// Wake up at most n threads in state sleeping on chan, and
+// return the last one woken, or 0.  If nwoken is not 0, the
+// number woken is stored there.  Sleepers are taken off
+// the wait queue first and then made RUNNABLE under their
+// proc locks, since the proc lock comes first in the lock
+// order.  A caller holding a proc lock may only wake
+// threads of that proc.
+static struct thread*
+wakeupstate(void *chan, enum threadstate state, int n, int *nwoken)
 {
+  struct waitq *wq = &ptable.waitq[WAITQ(chan)];
+  struct thread *batch[WAKEBATCH];
+  struct thread *t, *next, *woken;
   struct proc *p;
-  struct thread *t;
+  int i, k, nw, more, locked;
+
+  woken = 0;
+  nw = 0;
+  do {
+    k = 0;
+    more = 0;
+    acquire(&wq->lock);
+    for(t = wq->head; t != 0; t = next){
+      next = t->wnext;
+      if(t->state == state && t->chan == chan){
+        if(k == WAKEBATCH || nw + k == n){
+          more = 1;
+          break;
+        }
+        wqunlink(wq, t);
+        batch[k++] = t;
+      }
+    }
+    release(&wq->lock);
+
+    for(i = 0; i < k; i++){
+      t = batch[i];
+      p = t->proc;
+      locked = !holding(&p->lock);
+      if(locked)
+        acquire(&p->lock);
+      // Recheck: kill() may have woken t meanwhile, and
+      // it may even be asleep again, or have been reaped
+      // and handed to another proc.
+      if(t->proc == p && t->state == state && t->chan == chan){
+        wqremove(t);
+        setrunnable(t);
+        woken = t;
+        nw++;
+      }
+      if(locked)
+        release(&p->lock);
+    }
+  } while(more && nw < n);
+  if(nwoken)
+    *nwoken = nw;
+  return woken;
+}
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    for (t = p->threads; t < &p->threads[NTHREAD]; t++)
-      if(t->state == THREAD_SLEEPING && t->chan == chan)
-        t->state = RUNNABLE;
+static struct thread*
+wakeup2(void *chan)
+{
+  return wakeupstate(chan, THREAD_SLEEPING, NTHREAD, 0);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+  wakeupstate(chan, SLEEPING, NTHREAD, 0);
+}
+
+// Futexes.  Threads block on a user word by sleeping on the
+// kernel address of the word, so threads of processes that
+// share its page meet there too.  futexwait holds the futex
+// lock of the word's wait queue from its check of the word
+// until it is on the wait queue, and futexwake takes it
+// before looking, so a wakeup after a store to the word
+// can't be missed.  It comes before the proc lock in the
+// lock order.
+
+// Kernel address of the user word at addr, or 0 if addr is
+// not a valid, aligned address of the current process.
+static int*
+futexaddr(uint addr)
+{
+  struct proc *curproc = myproc();
+  char *ka;
+
+  if(addr % sizeof(int) != 0 || addr >= curproc->sz ||
+     addr + sizeof(int) > curproc->sz)
+    return 0;
+  if((ka = uva2ka(curproc->pgdir, (char*)addr)) == 0)
+    return 0;
+  return (int*)(ka + (addr & (PGSIZE-1)));
+}
+
+// Sleep on the word at addr if it still holds val.  Returns
+// 0 once woken, which may be spurious, or -1 at once if the
+// word has changed or addr is bad.
+int
+futexwait(uint addr, int val)
+{
+  struct spinlock *lk;
+  int *ka;
+
+  if((ka = futexaddr(addr)) == 0)
+    return -1;
+  lk = &ptable.waitq[WAITQ(ka)].futex;
+  acquire(lk);
+  if(*ka != val || myproc()->killed){
+    release(lk);
+    return -1;
+  }
+  sleep(ka, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake at most n threads waiting on the word at addr.
+// Returns how many were woken, or -1 if addr is bad.
+int
+futexwake(uint addr, int n)
+{
+  struct spinlock *lk;
+  int *ka;
+
+  if((ka = futexaddr(addr)) == 0)
+    return -1;
+  if(n <= 0)
+    return 0;
+  lk = &ptable.waitq[WAITQ(ka)].futex;
+  acquire(lk);
+  wakeupstate(ka, SLEEPING, n, &n);
+  release(lk);
+  return n;
 }
 
 // Kill the process with the given pid.
@@ -937,13 +2298,17 @@ kill(int pid)
   acquire(&ptable.lock);
   for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
     if(p->pid == pid){
+      acquire(&p->lock);
       p->killed = 1;
       // Wake process from sleep if necessary.
 
-      for(t = p->threads; t < &p->threads[NTHREAD]; t++)
-        if(t->state == SLEEPING || t->state == THREAD_SLEEPING)
-          t->state = RUNNABLE;
+      for(t = p->threads; t != 0; t = t->pnext)
+        if(t->state == SLEEPING || t->state == THREAD_SLEEPING){
+          wqremove(t);
+          setrunnable(t);
+        }
 
+      release(&p->lock);
       release(&ptable.lock);
       return 0;
     }
@@ -952,6 +2317,246 @@ kill(int pid)
   return -1;
 }
 
+// Copy out scheduler statistics: global and per-CPU counters
+// into st, and up to n live threads into ts.  Returns the
+// number of threads copied.
+int
+schedstat(struct schedstat *st, struct threadstat *ts, int n)
+{
+  struct proc *p;
+  struct thread *t;
+  int i;
+
+  acquire(&ptable.lock);
+  st->ticks = ticks;
+  st->nboost = ptable.nboost;
+  st->ncpu = ncpu;
+  st->policy = sclass - classes;
+  for(i = 0; i < ncpu; i++)
+    st->cpu[i] = runqs[i].stat;
+
+  i = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    acquire(&p->lock);
+    for(t = p->threads; t != 0 && i < n; t = t->pnext){
+      if(t->state == UNUSED)
+        continue;
+      ts[i].pid = p->pid;
+      ts[i].tid = t->tid;
+      ts[i].state = t->state;
+      ts[i].cpu = t->cpu;
+      ts[i].qlevel = t->qlevel;
+      ts[i].priority = t->priority;
+      ts[i].nvcsw = t->nvcsw;
+      ts[i].nivcsw = t->nivcsw;
+      ts[i].ndemote = t->ndemote;
+      ts[i].nboost = t->nboost;
+      ts[i].waitcycles = t->waitcycles;
+      memmove(ts[i].levticks, t->levticks, sizeof(ts[i].levticks));
+      i++;
+    }
+    release(&p->lock);
+  }
+  release(&ptable.lock);
+  return i;
+}
+
+// Thread tid of the current process, or the calling
+// thread if tid is 0.  The current proc's lock must be held.
+static struct thread*
+findthread(int tid)
+{
+  struct proc *curproc = myproc();
+  struct thread *t;
+
+  if(tid == 0)
+    return mythread();
+  for(t = curproc->threads; t != 0; t = t->pnext)
+    if(t->tid == tid && t->state != UNUSED && t->state != ZOMBIE)
+      return t;
+  return 0;
+}
+
+// Restrict thread tid of the current process to the CPUs
+// in mask.  A queued thread moves to an allowed CPU now; a
+// running one moves the next time it is queued, which is
+// at once if it is the caller.
+int
+setaffinity(int tid, uint mask)
+{
+  struct proc *curproc = myproc();
+  struct thread *t;
+  int move;
+
+  if((mask & ALLCPUS) == 0)
+    return -1;
+  acquire(&curproc->lock);
+  if((t = findthread(tid)) == 0){
+    release(&curproc->lock);
+    return -1;
+  }
+  t->affinity = mask;
+  if(t->state == RUNNABLE && !CANRUN(t, t->cpu)){
+    rqremove(t);
+    setrunnable(t);
+  }
+  move = t == mythread() && !CANRUN(t, cpuid());
+  release(&curproc->lock);
+  if(move)
+    yield();
+  return 0;
+}
+
+// Affinity mask of thread tid of the current process,
+// limited to the CPUs that exist.
+int
+getaffinity(int tid)
+{
+  struct proc *curproc = myproc();
+  struct thread *t;
+  int mask;
+
+  acquire(&curproc->lock);
+  if((t = findthread(tid)) == 0)
+    mask = -1;
+  else
+    mask = t->affinity & ALLCPUS;
+  release(&curproc->lock);
+  return mask;
+}
+
+// Switch every run queue to scheduling class policy, one of
+// the *_SCHED numbers, and return the old one, or -1 if there
+// is no such class.  With all queue locks held, the queued
+// threads outside the real-time class are taken off under
+// the old class and queued again, in the same order, under
+// the new one.  Running threads follow when next queued.
+int
+setschedpolicy(int policy)
+{
+  struct thread *moved[NCPU], *t;
+  struct runq *rq;
+  int i, old;
+
+  if(policy < 0 || policy >= NELEM(classes))
+    return -1;
+  for(i = 0; i < ncpu; i++)
+    acquire(&runqs[i].lock);
+  old = sclass - classes;
+
+  // Least urgent first, so the most urgent ends up in front.
+  for(i = 0; i < ncpu; i++){
+    rq = &runqs[i];
+    moved[i] = 0;
+    while((t = sclass->prev(rq, 0)) != 0){
+      sclass->dequeue(rq, t);
+      t->rqnext = moved[i];
+      moved[i] = t;
+    }
+  }
+
+  sclass = &classes[policy];
+  memset(ptable.runningthread, 0, sizeof(ptable.runningthread));
+  for(i = 0; i < ncpu; i++){
+    rq = &runqs[i];
+    while((t = moved[i]) != 0){
+      moved[i] = t->rqnext;
+      t->pass = rq->vpass;
+      sclass->enqueue(rq, t, 0);
+    }
+  }
+
+  for(i = ncpu-1; i >= 0; i--)
+    release(&runqs[i].lock);
+  return old;
+}
+
+// Put every thread of process pid in the real-time FIFO
+// class at priority rtprio, 1 to MAXRTPRIO, or move them back
+// to the normal class if rtprio is 0.  A real-time thread
+// runs ahead of every other thread and keeps its CPU until
+// it blocks, yields or a higher priority becomes runnable.
+int
+setrtprio(int pid, int rtprio)
+{
+  struct proc *p;
+  struct thread *t;
+
+  if(rtprio < 0 || rtprio > MAXRTPRIO)
+    return -1;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->pid != pid || p->threadcnt == 0)
+      continue;
+    acquire(&p->lock);
+    for(t = p->threads; t != 0; t = t->pnext){
+      if(t->state == RUNNABLE){
+        // Requeue in its new slot.
+        rqremove(t);
+        t->rtprio = rtprio;
+        setrunnable(t);
+      } else
+        t->rtprio = rtprio;
+    }
+    release(&p->lock);
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+// Swap the scheduling state of the running thread cur and
+// t, just taken off its run queue: the MLFQ level, ticks
+// used there and boost epoch, and the pass.  t then runs out
+// what is left of cur's slice, or from cur's place in pass
+// order, and cur waits in t's place, so that neither gains
+// on other threads.  Real-time priorities are not swapped.
+static void
+donate(struct thread *cur, struct thread *t)
+{
+  int qlevel, usedtq;
+  uint epoch, pass;
+
+  qlevel = cur->qlevel;
+  usedtq = cur->usedtq;
+  epoch = cur->epoch;
+  pass = cur->pass;
+  cur->qlevel = t->qlevel;
+  cur->usedtq = t->usedtq;
+  cur->epoch = t->epoch;
+  cur->pass = t->pass;
+  t->qlevel = qlevel;
+  t->usedtq = usedtq;
+  t->epoch = epoch;
+  t->pass = pass;
+}
+
+// Give the rest of the caller's time slice to thread tid of
+// the current process and switch straight to it, on this
+// CPU, whatever else is queued.  The caller is queued in
+// tid's place.  Fails if tid is not RUNNABLE or may not run
+// on this CPU.
+int
+thread_yield_to(int tid)
+{
+  struct thread *curthread = mythread();
+  struct proc *curproc = curthread->proc;
+  struct thread *t;
+
+  acquire(&curproc->lock);
+  if((t = findthread(tid)) == 0 || t == curthread || handoff(t) < 0){
+    release(&curproc->lock);
+    return -1;
+  }
+  donate(curthread, t);
+  countswitch(curthread, 0);
+  enqueue(curthread, 0);
+  schedto(t);
+  release(&curproc->lock);
+  return 0;
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
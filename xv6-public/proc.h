@@ -5,10 +5,14 @@ struct cpu {
   struct taskstate ts;         // Used by x86 to find stack for interrupt
   struct segdesc gdt[NSEGS];   // x86 global descriptor table
   volatile uint started;       // Has the CPU started?
+  volatile uint idle;          // Halted in scheduler() for lack of work?
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;
   struct thread *thread;      // The thread running on this cpu or null
+  struct spinlock *prevlock;   // Left held by the last thread, see sched()
+  struct proc *pgproc;         // Process whose page table was last loaded
+  uint pggen;                  // and its pggen then, see switchthread
 };
 
 extern struct cpu cpus[NCPU];
@@ -43,24 +47,56 @@ struct thread {
   void *chan;                  // If non-zero, sleeping on chan
   enum threadstate state;        // Process state
   struct proc *proc;         // parent process
+  struct thread *pnext;        // Next thread of proc, or next free one
+  uint ustack;                 // Top of user stack, 0 if from exec
+  uint tls;                    // Base of user %gs segment, see settls
   void *retval;
+  struct thread *rqnext;       // Run queue links while RUNNABLE
+  struct thread *rqprev;
+  struct thread *wnext;        // Wait queue links while sleeping
+  struct thread *wprev;
+  int cpu;                     // CPU whose run queue holds this thread
+  int rqidx;                   // Run queue slot while RUNNABLE
+  uint lastran;                // ticks when last descheduled
+  int qlevel;                  // MLFQ queue level
+  int priority;                // MLFQ priority
+  int rtprio;                  // real-time FIFO priority, 0 if none
+  int usedtq;                  // used time quantum
+  uint pass;                   // stride scheduling pass value
+  uint affinity;               // bit i set: may run on CPU i
+  uint epoch;                  // boost epoch last applied, see catchup
+  uint64 enqtime;              // rdtsc() when last made RUNNABLE
+  uint64 waitcycles;           // Scheduler statistics, see schedstat.h
+  uint nvcsw;
+  uint nivcsw;
+  uint ndemote;
+  uint nboost;
+  uint levticks[MLFQ_K];
+};
+
+// Per-user CPU account for fair-share scheduling.
+struct account {
+  char name[16];               // Login name, empty if unused
+  int nactive;                 // Procs with a RUNNABLE or RUNNING thread
 };
 
 // Per-process state
 struct proc {
+  struct spinlock lock;        // Guards the threads' states, killed
   int pid;                     // Process ID
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
+  uint pggen;                  // Bumped when user mappings are removed
   struct thread *parent;         // Parent process
   int killed;                  // If non-zero, have been killed
+  struct thread *exiter;       // Thread running exit(), if any
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  int qlevel;	       	       // MLFQ queue level
-  int priority;                // MLFQ priority
-  int usedtq;                  // used time quantum
-  struct thread threads[NTHREAD];
-  int threadcnt;
+  struct thread *threads;      // Thread list, oldest first
+  int threadcnt;               // Threads that are not UNUSED
+  struct account *acct;        // CPU account of the owning user
+  int nactive;                 // Threads RUNNABLE or RUNNING
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,133 @@
+// Real-time FIFO wakeup latency test.
+// Must run as root.  Everything is pinned to CPU 0.  A hog
+// child spins, and a real-time child blocks reading rdtsc()
+// stamps from a pipe.  The parent writes a stamp and then
+// spins too, so after every write the reader has to preempt
+// a busy CPU.  Its worst wakeup latency must stay well under
+// one timer tick, which is all a normal thread would wait.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "param.h"
+
+#define NROUND  50
+#define SPIN    2   // ticks the parent spins after each write
+
+// Cycles between two timer ticks.
+uint64
+tickcycles(void)
+{
+  int t;
+  uint64 t0;
+
+  t = uptime();
+  while(uptime() == t)
+    ;
+  t0 = rdtsc();
+  t = uptime();
+  while(uptime() == t)
+    ;
+  return rdtsc() - t0;
+}
+
+void
+spin(int n)
+{
+  int end = uptime() + n;
+
+  while(uptime() < end)
+    ;
+}
+
+// Read NROUND stamps from in and send back the worst
+// and the median latency.
+void
+reader(int in, int out)
+{
+  uint64 stamp, lat[NROUND], v;
+  int i, j;
+
+  for(i = 0; i < NROUND; i++){
+    if(read(in, &stamp, sizeof(stamp)) != sizeof(stamp))
+      exit();
+    lat[i] = rdtsc() - stamp;
+  }
+  for(i = 1; i < NROUND; i++){
+    v = lat[i];
+    for(j = i; j > 0 && lat[j-1] > v; j--)
+      lat[j] = lat[j-1];
+    lat[j] = v;
+  }
+  write(out, &lat[NROUND-1], sizeof(lat[0]));
+  write(out, &lat[NROUND/2], sizeof(lat[0]));
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  int p1[2], p2[2], i, hog, rt, failed;
+  uint64 tick, stamp, worst, median;
+
+  printf(1, "rt test start\n");
+  failed = 0;
+  if(setrtprio(getpid(), MAXRTPRIO+1) >= 0){
+    printf(1, "bad priority accepted\n");
+    failed = 1;
+  }
+
+  sched_setaffinity(0, 1);
+  tick = tickcycles();
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+
+  if((hog = fork()) == 0){
+    for(;;)
+      ;
+  }
+  if((rt = fork()) == 0){
+    close(p1[1]);
+    close(p2[0]);
+    reader(p1[0], p2[1]);
+  }
+  if(hog < 0 || rt < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  close(p1[0]);
+  close(p2[1]);
+  if(setrtprio(rt, 1) < 0){
+    printf(1, "setrtprio failed (not root?)\n");
+    kill(hog);
+    kill(rt);
+    wait();
+    wait();
+    exit();
+  }
+
+  for(i = 0; i < NROUND; i++){
+    stamp = rdtsc();
+    write(p1[1], &stamp, sizeof(stamp));
+    spin(SPIN);
+  }
+  if(read(p2[0], &worst, sizeof(worst)) != sizeof(worst) ||
+     read(p2[0], &median, sizeof(median)) != sizeof(median)){
+    printf(1, "short read\n");
+    failed = 1;
+  } else {
+    printf(1, "wakeup latency: median %d, worst %d cycles; tick %d cycles\n",
+           (uint)median, (uint)worst, (uint)tick);
+    if(worst > tick/4)
+      failed = 1;
+  }
+
+  kill(hog);
+  wait();
+  wait();
+  printf(1, failed ? "rt test failed\n" : "rt test ok\n");
+  exit();
+}
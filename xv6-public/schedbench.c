@@ -0,0 +1,282 @@
+// Scheduler microbenchmarks.
+// usage: schedbench [yield|yieldto|pipe|thread|fork|forkscale|all] [n]
+//
+// Each benchmark times n operations with rdtsc and prints
+// the min, median and 99th percentile in cycles, plus the
+// elapsed ticks and the rate in operations per second.
+// yield, yieldto and pipe pin both sides to CPU 0, so they
+// measure a switch between two threads on one CPU.
+// forkscale runs fork+wait loops in 1, 2, 4, ... processes
+// at once, up to the number of CPUs, to show how well
+// process creation scales.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "param.h"
+#include "schedstat.h"
+
+#define MAXN     2000
+#define DEFAULTN 1000
+#define HZ       100   // timer ticks per second
+
+uint samples[MAXN];
+
+void
+report(char *name, int n, int ticks)
+{
+  int i, j, gap;
+  uint v;
+
+  // Shell sort; n is small.
+  for(gap = n/2; gap > 0; gap /= 2){
+    for(i = gap; i < n; i++){
+      v = samples[i];
+      for(j = i; j >= gap && samples[j-gap] > v; j -= gap)
+        samples[j] = samples[j-gap];
+      samples[j] = v;
+    }
+  }
+  printf(1, "%s\tn %d\tmin %d\tmedian %d\tp99 %d\tticks %d\tops/s %d\n",
+         name, n, samples[0], samples[n/2], samples[n*99/100], ticks,
+         ticks ? n*HZ/ticks : 0);
+}
+
+// Yield round trip: the parent yields to a child that does
+// nothing but yield back.
+void
+benchyield(int n)
+{
+  int i, pid, start;
+  uint64 t0;
+
+  sched_setaffinity(0, 1);
+  if((pid = fork()) < 0){
+    printf(1, "fork failed\n");
+    return;
+  }
+  if(pid == 0){
+    for(;;)
+      yield();
+  }
+  start = uptime();
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    yield();
+    samples[i] = rdtsc() - t0;
+  }
+  report("yield", n, uptime() - start);
+  kill(pid);
+  wait();
+  sched_setaffinity(0, ~0);
+}
+
+volatile int stop;
+
+void*
+yielder(void *arg)
+{
+  while(!stop)
+    yield();
+  thread_exit(0);
+  return 0;
+}
+
+// thread_yield_to round trip: the main thread hands the CPU
+// to a thread of its own process that yields straight back.
+void
+benchyieldto(int n)
+{
+  int i, start;
+  thread_t tid;
+  uint64 t0;
+  void *ret;
+
+  sched_setaffinity(0, 1);
+  stop = 0;
+  if(thread_create(&tid, yielder, 0) < 0){
+    printf(1, "thread_create failed\n");
+    return;
+  }
+  start = uptime();
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    if(thread_yield_to(tid) < 0)
+      yield();
+    samples[i] = rdtsc() - t0;
+  }
+  report("yieldto", n, uptime() - start);
+  stop = 1;
+  thread_join(tid, &ret);
+  sched_setaffinity(0, ~0);
+}
+
+// Pipe ping-pong: one byte to a child and back again.
+void
+benchpipe(int n)
+{
+  int i, pid, start, p1[2], p2[2];
+  uint64 t0;
+  char c;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf(1, "pipe failed\n");
+    return;
+  }
+  sched_setaffinity(0, 1);
+  if((pid = fork()) < 0){
+    printf(1, "fork failed\n");
+    return;
+  }
+  if(pid == 0){
+    close(p1[1]);
+    close(p2[0]);
+    while(read(p1[0], &c, 1) == 1)
+      write(p2[1], &c, 1);
+    exit();
+  }
+  close(p1[0]);
+  close(p2[1]);
+  c = 0;
+  start = uptime();
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    write(p1[1], &c, 1);
+    read(p2[0], &c, 1);
+    samples[i] = rdtsc() - t0;
+  }
+  report("pipe", n, uptime() - start);
+  close(p1[1]);
+  close(p2[0]);
+  wait();
+  sched_setaffinity(0, ~0);
+}
+
+void*
+nop(void *arg)
+{
+  thread_exit(arg);
+  return 0;
+}
+
+// thread_create of a thread that exits at once, then
+// thread_join.  Each new thread reuses the stack of the
+// one joined before it, so the process doesn't grow.
+void
+benchthread(int n)
+{
+  int i, start;
+  thread_t tid;
+  uint64 t0;
+  void *ret;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    if(thread_create(&tid, nop, 0) < 0 || thread_join(tid, &ret) < 0){
+      printf(1, "thread_create/join failed\n");
+      return;
+    }
+    samples[i] = rdtsc() - t0;
+  }
+  report("thread", n, uptime() - start);
+}
+
+// fork of a child that exits at once, then wait.
+void
+benchfork(int n)
+{
+  int i, pid, start;
+  uint64 t0;
+
+  start = uptime();
+  for(i = 0; i < n; i++){
+    t0 = rdtsc();
+    if((pid = fork()) < 0){
+      printf(1, "fork failed\n");
+      return;
+    }
+    if(pid == 0)
+      exit();
+    wait();
+    samples[i] = rdtsc() - t0;
+  }
+  report("fork", n, uptime() - start);
+}
+
+struct schedstat st;
+
+// k processes each fork and wait for n children at once;
+// only the total rate is reported.
+void
+benchforkscale(int n)
+{
+  int i, k, w, pid, start, ticks;
+
+  if(schedstat(&st, 0, 0) < 0){
+    printf(1, "schedstat failed\n");
+    return;
+  }
+  for(k = 1; k <= st.ncpu; k *= 2){
+    start = uptime();
+    for(w = 0; w < k; w++){
+      if((pid = fork()) < 0){
+        printf(1, "fork failed\n");
+        return;
+      }
+      if(pid == 0){
+        for(i = 0; i < n; i++){
+          if((pid = fork()) < 0)
+            break;
+          if(pid == 0)
+            exit();
+          wait();
+        }
+        exit();
+      }
+    }
+    for(w = 0; w < k; w++)
+      wait();
+    ticks = uptime() - start;
+    printf(1, "forkscale\tprocs %d\tn %d\tticks %d\tops/s %d\n",
+           k, k*n, ticks, ticks ? k*n*HZ/ticks : 0);
+  }
+}
+
+struct bench {
+  char *name;
+  void (*fn)(int);
+} benches[] = {
+  { "yield",  benchyield },
+  { "yieldto", benchyieldto },
+  { "pipe",   benchpipe },
+  { "thread", benchthread },
+  { "fork",   benchfork },
+  { "forkscale", benchforkscale },
+};
+
+int
+main(int argc, char *argv[])
+{
+  char *which;
+  int i, n, ran;
+
+  which = argc > 1 ? argv[1] : "all";
+  n = argc > 2 ? atoi(argv[2]) : DEFAULTN;
+  if(n <= 0 || n > MAXN){
+    printf(2, "schedbench: n must be 1..%d\n", MAXN);
+    exit();
+  }
+
+  ran = 0;
+  for(i = 0; i < sizeof(benches)/sizeof(benches[0]); i++){
+    if(strcmp(which, "all") == 0 || strcmp(which, benches[i].name) == 0){
+      benches[i].fn(n);
+      ran = 1;
+    }
+  }
+  if(!ran)
+    printf(2, "usage: schedbench [yield|yieldto|pipe|thread|fork|forkscale|all] [n]\n");
+  exit();
+}
@@ -0,0 +1,47 @@
+// Show or switch the scheduling class.
+// usage: schedpolicy [rr|multilevel|mlfq|stride|fairshare]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedstat.h"
+
+char *policies[] = {
+[RR_SCHED]         "rr",
+[MULTILEVEL_SCHED] "multilevel",
+[MLFQ_SCHED]       "mlfq",
+[STRIDE_SCHED]     "stride",
+[FAIRSHARE_SCHED]  "fairshare",
+};
+
+struct schedstat st;
+
+int
+main(int argc, char *argv[])
+{
+  int i, old;
+
+  if(argc < 2){
+    if(schedstat(&st, 0, 0) < 0){
+      printf(2, "schedpolicy: schedstat failed\n");
+      exit();
+    }
+    printf(1, "%s\n", policies[st.policy]);
+    exit();
+  }
+
+  for(i = 0; i < sizeof(policies)/sizeof(policies[0]); i++)
+    if(strcmp(argv[1], policies[i]) == 0)
+      break;
+  if(i == sizeof(policies)/sizeof(policies[0])){
+    printf(2, "usage: schedpolicy [rr|multilevel|mlfq|stride|fairshare]\n");
+    exit();
+  }
+  if((old = setschedpolicy(i)) < 0){
+    printf(2, "schedpolicy: permission denied\n");
+    exit();
+  }
+  printf(1, "%s -> %s\n", policies[old], policies[i]);
+  exit();
+}
@@ -0,0 +1,88 @@
+// Print scheduler statistics.
+// usage: schedstat [pid]
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedstat.h"
+
+static char *states[] = {
+  "unused", "embryo", "sleep", "runble", "run", "zombie", "tsleep"
+};
+
+static char *policies[] = {
+[RR_SCHED]         "rr",
+[MULTILEVEL_SCHED] "multilevel",
+[MLFQ_SCHED]       "mlfq",
+[STRIDE_SCHED]     "stride",
+[FAIRSHARE_SCHED]  "fairshare",
+};
+
+struct schedstat st;
+struct threadstat ts[NTHREAD];
+
+void
+printcpus(void)
+{
+  struct cpustat *c;
+  int i, b;
+
+  printf(1, "policy %s ticks %d boosts %d\n", policies[st.policy],
+         st.ticks, st.nboost);
+  printf(1, "cpu\tswitch\tvol\tinvol\tsteal\tidle\tdemote\n");
+  for(i = 0; i < st.ncpu; i++){
+    c = &st.cpu[i];
+    printf(1, "%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i, c->nswitch, c->nvcsw,
+           c->nivcsw, c->nsteal, c->nidle, c->ndemote);
+  }
+
+  printf(1, "runnable wait (cycles)\n");
+  for(b = 0; b < NWAITHIST; b++){
+    if(b == NWAITHIST-1)
+      printf(1, ">=2^%d", WAITHIST_SHIFT+b-1);
+    else
+      printf(1, "<2^%d", WAITHIST_SHIFT+b);
+    for(i = 0; i < st.ncpu; i++)
+      printf(1, "\t%d", st.cpu[i].waithist[b]);
+    printf(1, "\n");
+  }
+}
+
+void
+printthreads(int n, int pid)
+{
+  struct threadstat *t;
+  int i, l;
+
+  printf(1, "pid\ttid\tstate\tcpu\tlev\tprio\tvol\tinvol\tdemote\tboost\twaitKc");
+  for(l = 0; l < MLFQ_K; l++)
+    printf(1, "\tL%d", l);
+  printf(1, "\n");
+  for(i = 0; i < n; i++){
+    t = &ts[i];
+    if(pid && t->pid != pid)
+      continue;
+    printf(1, "%d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d", t->pid, t->tid,
+           states[t->state], t->cpu, t->qlevel, t->priority, t->nvcsw,
+           t->nivcsw, t->ndemote, t->nboost, (uint)(t->waitcycles >> 10));
+    for(l = 0; l < MLFQ_K; l++)
+      printf(1, "\t%d", t->levticks[l]);
+    printf(1, "\n");
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, pid;
+
+  pid = argc > 1 ? atoi(argv[1]) : 0;
+  if((n = schedstat(&st, ts, sizeof(ts)/sizeof(ts[0]))) < 0){
+    printf(2, "schedstat: failed\n");
+    exit();
+  }
+  printcpus();
+  printthreads(n, pid);
+  exit();
+}
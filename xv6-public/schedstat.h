@@ -0,0 +1,42 @@
+// Scheduler statistics returned by the schedstat system call.
+
+#define NWAITHIST     16  // buckets in the run queue wait histogram
+#define WAITHIST_SHIFT 10 // bucket 0 counts waits under 2^10 cycles
+
+// Per-CPU counters.  waithist counts how long threads sat
+// RUNNABLE before being picked: bucket 0 is under
+// 2^WAITHIST_SHIFT cycles, bucket i is under twice the bound
+// of bucket i-1, and the last bucket is open-ended.
+struct cpustat {
+  uint nswitch;                // threads switched in
+  uint nvcsw;                  // switches away from a thread that blocked or yielded
+  uint nivcsw;                 // switches away from a preempted thread
+  uint nsteal;                 // threads pulled over by balance()
+  uint nidle;                  // times halted with nothing to run
+  uint ndemote;                // MLFQ demotions
+  uint waithist[NWAITHIST];
+};
+
+// Per-thread counters.
+struct threadstat {
+  int pid;
+  int tid;
+  int state;                   // enum threadstate
+  int cpu;                     // CPU it last ran on
+  int qlevel;
+  int priority;
+  uint nvcsw;
+  uint nivcsw;
+  uint ndemote;
+  uint nboost;                 // times priorityboost() lifted it
+  uint64 waitcycles;           // total cycles spent RUNNABLE
+  uint levticks[MLFQ_K];       // ticks run at each MLFQ level
+};
+
+struct schedstat {
+  uint ticks;
+  uint nboost;                 // priorityboost() runs
+  int ncpu;
+  int policy;                  // scheduling class, a *_SCHED number
+  struct cpustat cpu[NCPU];
+};
@@ -0,0 +1,102 @@
+// Stride scheduling test: CPU share follows tickets.
+// Children at priorities 0, 2 and 5, holding 1, 3 and 6
+// tickets, count loops for the same DURATION ticks.  Each
+// child's share of all the loops must be within TOLERANCE
+// percent of its share of the tickets.
+// Needs one CPU (make qemu CPUS=1) and root.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NCHILD    3
+#define DURATION  500  // ticks to measure
+#define TOLERANCE 5    // allowed error, in percent of total CPU
+
+int prio[NCHILD] = {0, 2, 5};
+
+struct result {
+  int child;
+  uint count;
+};
+
+void
+spin(int child, int start, int fd)
+{
+  struct result r;
+
+  while(uptime() < start)
+    sleep(1);
+  r.child = child;
+  r.count = 0;
+  while(uptime() < start + DURATION)
+    r.count++;
+  write(fd, &r, sizeof(r));
+  exit();
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct result r;
+  uint count[NCHILD], total;
+  int fd[2], i, pid, start, tickets, share, expect, err, failed, old;
+
+  if(pipe(fd) < 0){
+    printf(1, "pipe failed\n");
+    exit();
+  }
+
+  if((old = setschedpolicy(STRIDE_SCHED)) < 0){
+    printf(1, "setschedpolicy failed\n");
+    exit();
+  }
+  printf(1, "stride test start\n");
+  start = uptime() + 20;
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(fd[0]);
+      spin(i, start, fd[1]);
+    }
+    if(setpriority(pid, prio[i]) < 0){
+      printf(1, "setpriority failed\n");
+      exit();
+    }
+  }
+  close(fd[1]);
+
+  total = 0;
+  for(i = 0; i < NCHILD; i++){
+    if(read(fd[0], &r, sizeof(r)) != sizeof(r)){
+      printf(1, "short read\n");
+      exit();
+    }
+    count[r.child] = r.count;
+    total += r.count;
+  }
+  while(wait() != -1)
+    ;
+  setschedpolicy(old);
+
+  tickets = 0;
+  for(i = 0; i < NCHILD; i++)
+    tickets += prio[i] + 1;
+
+  failed = 0;
+  for(i = 0; i < NCHILD; i++){
+    share = count[i] / (total / 100 + 1);
+    expect = (prio[i] + 1) * 100 / tickets;
+    err = share > expect ? share - expect : expect - share;
+    if(err > TOLERANCE)
+      failed = 1;
+    printf(1, "child %d priority %d: %d loops, %d%% of CPU (expected %d%%)\n",
+           i, prio[i], count[i], share, expect);
+  }
+  printf(1, failed ? "stride test failed\n" : "stride test ok\n");
+  exit();
+}
@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
@@ -115,6 +116,15 @@ extern int sys_login(void);
 extern int sys_addUser(void);
 extern int sys_deleteUser(void);
 extern int sys_chmod(void);
+extern int sys_schedstat(void);
+extern int sys_sched_setaffinity(void);
+extern int sys_sched_getaffinity(void);
+extern int sys_thread_yield_to(void);
+extern int sys_setrtprio(void);
+extern int sys_setschedpolicy(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_settls(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -150,6 +160,15 @@ static int (*syscalls[])(void) = {
 [SYS_addUser] sys_addUser,
 [SYS_deleteUser]  sys_deleteUser,
 [SYS_chmod]   sys_chmod,
+[SYS_schedstat] sys_schedstat,
+[SYS_sched_setaffinity] sys_sched_setaffinity,
+[SYS_sched_getaffinity] sys_sched_getaffinity,
+[SYS_thread_yield_to] sys_thread_yield_to,
+[SYS_setrtprio] sys_setrtprio,
+[SYS_setschedpolicy] sys_setschedpolicy,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_settls] sys_settls,
 };
 
 void
@@ -32,3 +32,12 @@
 #define SYS_addUser 31
 #define SYS_deleteUser  32
 #define SYS_chmod   33
+#define SYS_schedstat 34
+#define SYS_sched_setaffinity 35
+#define SYS_sched_getaffinity 36
+#define SYS_thread_yield_to 37
+#define SYS_setrtprio 38
+#define SYS_setschedpolicy 39
+#define SYS_futex_wait 40
+#define SYS_futex_wake 41
+#define SYS_settls 42
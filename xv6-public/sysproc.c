@@ -5,7 +5,9 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
+#include "schedstat.h"
 
 int
 sys_fork(void)
@@ -51,7 +53,7 @@ sys_getppid(void)
 int
 sys_yield(void)
 {
-  resetproc(myproc());
+  resetthread(mythread());
   yield();
   return 0;
 }
@@ -59,18 +61,23 @@ sys_yield(void)
 int
 sys_getlev(void)
 {
-  return myproc()->qlevel;
+  return mythread()->qlevel;
 }
 
 int
 setpriority(int pid, int priority)
 {
-  if(priority < 0 || priority > 10) return -2;
+  if(priority < 0 || priority > MAXPRIO) return -2;
 
   struct proc *p = getproc(pid);
+  struct thread *t;
   if(p->parent->proc->pid != myproc()->pid) return -1;
 
-  p->priority = priority;
+  // p's lock keeps threads from coming and going under us.
+  acquire(&p->lock);
+  for(t = p->threads; t != 0; t = t->pnext)
+    t->priority = priority;
+  release(&p->lock);
   return 0;
 }
 
@@ -118,16 +125,128 @@ sys_thread_join(void)
   return thread_join((thread_t)thread, (void**)retval);
 }
 
+int
+sys_thread_yield_to(void)
+{
+  int tid;
+
+  if(argint(0, &tid) < 0)
+    return -1;
+  return thread_yield_to(tid);
+}
+
+int
+sys_schedstat(void)
+{
+  struct schedstat *st;
+  struct threadstat *ts;
+  int n;
+
+  if(argint(2, &n) < 0 || n < 0)
+    return -1;
+  // There are never more threads than NTHREAD, and a larger n
+  // could overflow the size argptr checks.
+  if(n > NTHREAD)
+    n = NTHREAD;
+  if(argptr(0, (char**)&st, sizeof(*st)) < 0 ||
+     argptr(1, (char**)&ts, n*sizeof(*ts)) < 0)
+    return -1;
+  return schedstat(st, ts, n);
+}
+
+int
+sys_sched_setaffinity(void)
+{
+  int tid, mask;
+
+  if(argint(0, &tid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(tid, (uint)mask);
+}
+
+int
+sys_sched_getaffinity(void)
+{
+  int tid;
+
+  if(argint(0, &tid) < 0)
+    return -1;
+  return getaffinity(tid);
+}
+
+// Only root may move a process into the real-time class,
+// where it can starve everything else.
+int
+sys_setrtprio(void)
+{
+  int pid, rtprio;
+
+  if(argint(0, &pid) < 0 || argint(1, &rtprio) < 0)
+    return -1;
+  if(!isroot)
+    return -1;
+  return setrtprio(pid, rtprio);
+}
+
+// Switching the scheduling class affects everyone, so it
+// is root-only too.
+int
+sys_setschedpolicy(void)
+{
+  int policy;
+
+  if(argint(0, &policy) < 0)
+    return -1;
+  if(!isroot)
+    return -1;
+  return setschedpolicy(policy);
+}
+
+int
+sys_futex_wait(void)
+{
+  int addr, val;
+
+  if(argint(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+int
+sys_futex_wake(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
+int
+sys_settls(void)
+{
+  int base;
+
+  if(argint(0, &base) < 0)
+    return -1;
+  return settls(base);
+}
+
+// Returns the old break, where the new memory starts.  That
+// may be lower than the break before the call: when short
+// of memory, growproc frees idle thread stacks at the top
+// and moves the break down past them first.  So callers
+// must use the returned base, not one from an earlier
+// sbrk(0).
 int
 sys_sbrk(void)
 {
-  int addr;
+  uint addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  if(growproc(n, &addr) < 0)
     return -1;
   return addr;
 }
@@ -141,7 +260,7 @@ sys_sleep(void)
   if(argint(0, &n) < 0)
     return -1;
   
-  resetproc(myproc());
+  resetthread(mythread());
   acquire(&tickslock);
   ticks0 = ticks;
   while(ticks - ticks0 < n){
@@ -99,6 +99,12 @@ void *thread_sbrk(void *arg)
   thread_exit(arg);
   return 0;
 }
+void *thread_nop(void *arg)
+{
+  thread_exit(arg);
+  return 0;
+}
+
 void create_all(int n, void *(*entry)(void *))
 {
   int i;
@@ -161,6 +167,22 @@ int main(int argc, char *argv[])
   join_all(NUM_THREAD);
   printf(1, "Test 3 passed\n\n");
 
+  printf(1, "Test 4: Stack reuse test\n");
+  create_all(NUM_THREAD, thread_nop);
+  join_all(NUM_THREAD);
+  char *brk = sbrk(0);
+  for (i = 0; i < 1000; i++) {
+    create_all(NUM_THREAD, thread_nop);
+    join_all(NUM_THREAD);
+  }
+  // Under memory pressure idle stacks may be freed and the
+  // break lowered, but the process must never grow.
+  if (sbrk(0) > brk) {
+    printf(1, "Process grew by %d bytes\n", sbrk(0) - brk);
+    failed();
+  }
+  printf(1, "Test 4 passed\n\n");
+
   printf(1, "All tests passed!\n");
   exit();
 }
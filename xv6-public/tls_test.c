@@ -0,0 +1,73 @@
+// Thread-local storage test.
+// Each thread points %gs at its own block with settls and
+// keeps a counter there, yielding now and then so that
+// threads trade CPUs.  Every thread must see only its own
+// counter, and the main thread's block must survive too.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NWORKER 4
+#define NROUND  1000
+
+struct tls {
+  uint self;                   // which thread owns the block
+  uint count;
+};
+
+struct tls blocks[NWORKER+1];
+volatile int failed;
+
+void
+run(uint me)
+{
+  int i;
+
+  settls(&blocks[me]);
+  tlsset(0, me);
+  tlsset(4, 0);
+  for(i = 0; i < NROUND; i++){
+    tlsset(4, tlsget(4) + 1);
+    if(i % 100 == 0)
+      yield();
+    if(tlsget(0) != me){
+      printf(1, "thread %d sees block of %d\n", me, tlsget(0));
+      failed = 1;
+      return;
+    }
+  }
+  if(blocks[me].count != NROUND){
+    printf(1, "thread %d counted %d\n", me, blocks[me].count);
+    failed = 1;
+  }
+}
+
+void*
+worker(void *arg)
+{
+  run((uint)arg);
+  thread_exit(0);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  thread_t tid[NWORKER];
+  void *ret;
+  int i;
+
+  printf(1, "tls test start\n");
+  for(i = 0; i < NWORKER; i++){
+    if(thread_create(&tid[i], worker, (void*)(i + 1)) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  run(0);
+  for(i = 0; i < NWORKER; i++)
+    thread_join(tid[i], &ret);
+  printf(1, failed ? "tls test failed\n" : "tls test ok\n");
+  exit();
+}
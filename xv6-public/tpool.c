@@ -0,0 +1,324 @@
+// Work-stealing thread pool.  See tpool.h.
+//
+// Deques follow Chase and Lev, "Dynamic Circular Work-Stealing
+// Deque", without the growing: a push onto a full deque runs
+// the task at once instead.  On x86 only the owner's pop
+// needs a fence between its store to bottom and its load of
+// top, which the xchg gives.  A thief copies its task out
+// before the cmpxchg on top that claims it, and the owner
+// never reuses a slot at or above top, so the copy is good
+// whenever the cmpxchg succeeds.
+//
+// Sleeping follows usync: an idle worker counts itself in
+// nidle, looks for work once more, and futex_waits on seq;
+// a submitter bumps seq after queueing and wakes a worker if
+// nidle says one may be asleep.
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "param.h"
+#include "schedstat.h"
+#include "usync.h"
+#include "tpool.h"
+
+#define WAKEALL  0x7fffffff
+
+// Keep the compiler from moving memory accesses across this.
+#define barrier() asm volatile("" : : : "memory")
+
+static void runtask(struct tpool*, struct tptask*);
+
+// The calling thread's worker in p, or 0 if it isn't one.
+static struct tpworker*
+self(struct tpool *p)
+{
+  struct tpworker *w;
+  int i;
+
+  w = (struct tpworker*)tlsget(0);
+  for(i = 0; i < p->nworker; i++)
+    if(w == &p->w[i])
+      return w;
+  return 0;
+}
+
+// Owner only.  Returns -1 if the deque is full.
+static int
+push(struct tpworker *w, struct tptask *t)
+{
+  uint b;
+
+  b = w->bottom;
+  if(b - w->top >= TP_DEQUE)
+    return -1;
+  w->buf[b & (TP_DEQUE-1)] = *t;
+  barrier();
+  w->bottom = b + 1;
+  return 0;
+}
+
+// Owner only.  Returns -1 if the deque is empty.
+static int
+pop(struct tpworker *w, struct tptask *t)
+{
+  uint b, top;
+  int ok;
+
+  b = w->bottom - 1;
+  xchg(&w->bottom, b);
+  top = w->top;
+  if((int)(b - top) < 0){
+    w->bottom = b + 1;
+    return -1;
+  }
+  *t = w->buf[b & (TP_DEQUE-1)];
+  if(b != top)
+    return 0;
+  // The last task: race the thieves for it.
+  ok = cmpxchg(&w->top, top, top + 1) == top;
+  w->bottom = b + 1;
+  return ok ? 0 : -1;
+}
+
+// Any thread.  Returns -1 if there was nothing to take or
+// another thread took it first.
+static int
+steal(struct tpworker *w, struct tptask *t)
+{
+  uint top, b;
+
+  top = w->top;
+  barrier();
+  b = w->bottom;
+  if((int)(b - top) <= 0)
+    return -1;
+  *t = w->buf[top & (TP_DEQUE-1)];
+  barrier();
+  if(cmpxchg(&w->top, top, top + 1) != top)
+    return -1;
+  return 0;
+}
+
+// Shared queue, for tasks from outside the pool.
+static int
+qpush(struct tpool *p, struct tptask *t)
+{
+  int ok;
+
+  mutex_lock(&p->qlock);
+  ok = p->qtail - p->qhead < TP_QUEUE;
+  if(ok)
+    p->q[p->qtail++ % TP_QUEUE] = *t;
+  mutex_unlock(&p->qlock);
+  return ok ? 0 : -1;
+}
+
+static int
+qpop(struct tpool *p, struct tptask *t)
+{
+  int ok;
+
+  if(p->qhead == p->qtail)
+    return -1;
+  mutex_lock(&p->qlock);
+  ok = p->qhead != p->qtail;
+  if(ok)
+    *t = p->q[p->qhead++ % TP_QUEUE];
+  mutex_unlock(&p->qlock);
+  return ok ? 0 : -1;
+}
+
+// Find a task: our own deque first, then the shared queue,
+// then the other workers' deques, starting past our own.
+static int
+findwork(struct tpool *p, struct tpworker *w, struct tptask *t)
+{
+  int i, start;
+
+  if(w && pop(w, t) == 0)
+    return 0;
+  if(qpop(p, t) == 0)
+    return 0;
+  start = w ? w - p->w + 1 : 0;
+  for(i = 0; i < p->nworker; i++)
+    if(steal(&p->w[(start + i) % p->nworker], t) == 0)
+      return 0;
+  return -1;
+}
+
+// Queue t, or run it here if there is no room.
+static void
+enqueue(struct tpool *p, struct tptask *t)
+{
+  struct tpworker *w;
+  int r;
+
+  fetchadd(&p->pending, 1);
+  w = self(p);
+  r = w ? push(w, t) : qpush(p, t);
+  if(r < 0){
+    runtask(p, t);
+    return;
+  }
+  fetchadd(&p->seq, 1);
+  if(p->nidle)
+    futex_wake((volatile int*)&p->seq, 1);
+}
+
+// Run t and count it finished.  A range longer than its
+// grain is halved, and the upper halves queued for others
+// to steal, until what is left is short enough to run here.
+static void
+runtask(struct tpool *p, struct tptask *t)
+{
+  struct tptask sub;
+  int lo, hi;
+
+  if(t->fn)
+    t->fn(t->arg);
+  else {
+    lo = t->lo;
+    hi = t->hi;
+    while(hi - lo > t->grain){
+      sub = *t;
+      sub.lo = lo + (hi - lo) / 2;
+      sub.hi = hi;
+      enqueue(p, &sub);
+      hi = sub.lo;
+    }
+    t->body(t->arg, lo, hi);
+  }
+  if(fetchadd(&p->pending, -1) == 1 && p->nwaiters)
+    futex_wake((volatile int*)&p->pending, WAKEALL);
+}
+
+static void*
+worker(void *arg)
+{
+  struct tpworker *w = arg;
+  struct tpool *p = w->pool;
+  struct tptask t;
+  uint seq;
+
+  settls(w);
+  for(;;){
+    if(findwork(p, w, &t) == 0){
+      runtask(p, &t);
+      continue;
+    }
+    seq = p->seq;
+    fetchadd(&p->nidle, 1);
+    if(findwork(p, w, &t) == 0){
+      fetchadd(&p->nidle, -1);
+      runtask(p, &t);
+      continue;
+    }
+    if(p->stop){
+      fetchadd(&p->nidle, -1);
+      break;
+    }
+    futex_wait((volatile int*)&p->seq, seq);
+    fetchadd(&p->nidle, -1);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Start a pool of n workers, or one per CPU if n is 0.
+// Returns 0, or -1 if the workers could not be started.
+int
+tp_init(struct tpool *p, int n)
+{
+  struct schedstat st;
+  int i;
+
+  if(n <= 0)
+    n = schedstat(&st, 0, 0) < 0 ? 1 : st.ncpu;
+  if(n > TP_MAXWORKER)
+    n = TP_MAXWORKER;
+  memset(p, 0, sizeof(*p));
+  mutex_init(&p->qlock);
+  for(i = 0; i < n; i++){
+    p->w[i].self = &p->w[i];
+    p->w[i].pool = p;
+  }
+  p->nworker = n;
+  for(i = 0; i < n; i++){
+    if(thread_create(&p->w[i].tid, worker, &p->w[i]) < 0){
+      p->nworker = i;
+      tp_destroy(p);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Run fn(arg) on some worker.
+void
+tp_submit(struct tpool *p, void (*fn)(void*), void *arg)
+{
+  struct tptask t;
+
+  t.fn = fn;
+  t.body = 0;
+  t.arg = arg;
+  t.lo = t.hi = t.grain = 0;
+  enqueue(p, &t);
+}
+
+// Wait until every task submitted so far, and every task
+// they submitted, has finished.  The caller runs tasks too
+// while it waits.  Must not be called from a task.
+void
+tp_wait(struct tpool *p)
+{
+  struct tptask t;
+  uint c;
+
+  while((c = p->pending) != 0){
+    if(findwork(p, self(p), &t) == 0){
+      runtask(p, &t);
+      continue;
+    }
+    fetchadd(&p->nwaiters, 1);
+    futex_wait((volatile int*)&p->pending, c);
+    fetchadd(&p->nwaiters, -1);
+  }
+}
+
+// Run body(arg, i, j) over pieces [i, j) of [lo, hi) no
+// longer than grain, in parallel, and wait for them all.
+// Like tp_wait, must not be called from a task.
+void
+tp_parallel_for(struct tpool *p, int lo, int hi, int grain,
+                void (*body)(void*, int, int), void *arg)
+{
+  struct tptask t;
+
+  if(lo >= hi)
+    return;
+  t.fn = 0;
+  t.body = body;
+  t.arg = arg;
+  t.lo = lo;
+  t.hi = hi;
+  t.grain = grain > 0 ? grain : 1;
+  enqueue(p, &t);
+  tp_wait(p);
+}
+
+// Finish all tasks, then stop and join the workers.
+void
+tp_destroy(struct tpool *p)
+{
+  void *ret;
+  int i;
+
+  tp_wait(p);
+  p->stop = 1;
+  fetchadd(&p->seq, 1);
+  futex_wake((volatile int*)&p->seq, WAKEALL);
+  for(i = 0; i < p->nworker; i++)
+    thread_join(p->w[i].tid, &ret);
+}
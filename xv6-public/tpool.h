@@ -0,0 +1,51 @@
+// Work-stealing thread pool (tpool.c), built on usync.
+// Needs usync.h included first.
+//
+// A pool runs a fixed set of worker threads, each with its
+// own Chase-Lev deque of tasks: a worker pushes and pops at
+// the bottom of its deque, and idle workers steal from the
+// top of the others'.  Tasks submitted from outside the pool
+// go on a shared queue.  The workers' %gs points at their
+// struct tpworker (see settls), so tasks must not call
+// settls themselves.
+
+#define TP_MAXWORKER 8     // most workers in a pool
+#define TP_DEQUE     256   // tasks per deque, a power of two
+#define TP_QUEUE     256   // tasks in the shared queue
+
+struct tptask {
+  void (*fn)(void*);            // run fn(arg), or else
+  void (*body)(void*, int, int); // body(arg, lo, hi) over [lo, hi)
+  void *arg;
+  int lo, hi;
+  int grain;                    // split ranges longer than this
+};
+
+struct tpworker {
+  struct tpworker *self;        // for %gs:0, see tpool.c
+  struct tpool *pool;
+  thread_t tid;
+  volatile uint top;            // next task to steal
+  volatile uint bottom;         // next free slot
+  struct tptask buf[TP_DEQUE];
+};
+
+struct tpool {
+  int nworker;
+  struct tpworker w[TP_MAXWORKER];
+  struct mutex qlock;           // guards the shared queue
+  volatile uint qhead, qtail;
+  struct tptask q[TP_QUEUE];
+  volatile uint pending;        // tasks submitted and not finished
+  volatile uint nwaiters;       // threads in tp_wait
+  volatile uint seq;            // bumped when work arrives
+  volatile uint nidle;          // workers asleep or about to be
+  volatile int stop;
+};
+
+int tp_init(struct tpool*, int);
+void tp_submit(struct tpool*, void (*)(void*), void*);
+void tp_wait(struct tpool*);
+void tp_parallel_for(struct tpool*, int, int, int,
+                     void (*)(void*, int, int), void*);
+void tp_destroy(struct tpool*);
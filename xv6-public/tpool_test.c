@@ -0,0 +1,128 @@
+// Thread pool test.
+// Checks tp_submit, tasks that submit more tasks, and
+// tp_parallel_for against sequential results, then times a
+// CPU-bound parallel for with one worker and with one per
+// CPU (run with make qemu CPUS=4 to see a speedup).
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "usync.h"
+#include "tpool.h"
+
+#define NTASK   1000
+#define DEPTH   10      // tree tasks: 2^DEPTH leaves
+#define N       100000
+#define WORK    200     // inner loop per element when timing
+
+struct tpool pool;
+volatile uint count;
+volatile uint sum;
+int failed;
+
+void
+bump(void *arg)
+{
+  fetchadd(&count, (int)arg);
+}
+
+void
+tree(void *arg)
+{
+  int depth = (int)arg;
+
+  if(depth == 0){
+    fetchadd(&count, 1);
+    return;
+  }
+  tp_submit(&pool, tree, (void*)(depth - 1));
+  tp_submit(&pool, tree, (void*)(depth - 1));
+}
+
+void
+sumsq(void *arg, int lo, int hi)
+{
+  uint s;
+  int i;
+
+  s = 0;
+  for(i = lo; i < hi; i++)
+    s += (uint)i * i;
+  fetchadd(&sum, s);
+}
+
+void
+spin(void *arg, int lo, int hi)
+{
+  volatile uint x;
+  int i, j;
+
+  x = 0;
+  for(i = lo; i < hi; i++)
+    for(j = 0; j < WORK; j++)
+      x += i ^ j;
+}
+
+int
+timefor(int nworker)
+{
+  int start, ticks;
+
+  if(tp_init(&pool, nworker) < 0){
+    printf(1, "tp_init failed\n");
+    exit();
+  }
+  start = uptime();
+  tp_parallel_for(&pool, 0, N, 256, spin, 0);
+  ticks = uptime() - start;
+  printf(1, "parallel for, %d workers: %d ticks\n", pool.nworker, ticks);
+  tp_destroy(&pool);
+  return ticks;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint expect;
+  int i;
+
+  printf(1, "tpool test start\n");
+  if(tp_init(&pool, 0) < 0){
+    printf(1, "tp_init failed\n");
+    exit();
+  }
+
+  count = 0;
+  for(i = 0; i < NTASK; i++)
+    tp_submit(&pool, bump, (void*)1);
+  tp_wait(&pool);
+  if(count != NTASK){
+    printf(1, "submit: count %d, expected %d\n", count, NTASK);
+    failed = 1;
+  }
+
+  count = 0;
+  tp_submit(&pool, tree, (void*)DEPTH);
+  tp_wait(&pool);
+  if(count != 1 << DEPTH){
+    printf(1, "tree: count %d, expected %d\n", count, 1 << DEPTH);
+    failed = 1;
+  }
+
+  expect = 0;
+  for(i = 0; i < N; i++)
+    expect += (uint)i * i;
+  sum = 0;
+  tp_parallel_for(&pool, 0, N, 100, sumsq, 0);
+  if(sum != expect){
+    printf(1, "parallel for: sum %d, expected %d\n", sum, expect);
+    failed = 1;
+  }
+  tp_destroy(&pool);
+
+  timefor(1);
+  timefor(0);
+
+  printf(1, failed ? "tpool test failed\n" : "tpool test ok\n");
+  exit();
+}
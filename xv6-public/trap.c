@@ -3,10 +3,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -57,6 +57,12 @@ trap(struct trapframe *tf)
     }
     lapiceoi();
     break;
+  case T_RESCHED:
+    // Sent to wake an idle CPU out of hlt, where
+    // scheduler() rechecks its run queue, or to have a
+    // busy one check for preemption (see below).
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
@@ -101,13 +107,13 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU on clock tick, or when a
+  // more urgent thread has been queued on this CPU.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && mythread()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER) {
-    increasetq(myproc());
-    yield();
-  }
+     ((tf->trapno == T_IRQ0+IRQ_TIMER && increasetq(mythread())) ||
+      (tf->trapno == T_RESCHED && preempt(mythread()))))
+    preemptyield();
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
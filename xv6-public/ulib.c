@@ -104,3 +104,20 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// Thread-local storage: the word at offset off from this
+// thread's settls() base, a single %gs-relative access.
+uint
+tlsget(uint off)
+{
+  uint v;
+
+  asm volatile("movl %%gs:(%1), %0" : "=r" (v) : "r" (off));
+  return v;
+}
+
+void
+tlsset(uint off, uint v)
+{
+  asm volatile("movl %0, %%gs:(%1)" : : "r" (v), "r" (off) : "memory");
+}
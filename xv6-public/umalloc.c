@@ -51,6 +51,8 @@ morecore(uint nu)
 
   if(nu < 4096)
     nu = 4096;
+  // The new memory starts where sbrk says, which need not
+  // be the end of the last block it gave us.
   p = sbrk(nu * sizeof(Header));
   if(p == (char*)-1)
     return 0;
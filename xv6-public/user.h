@@ -5,6 +5,8 @@
 
 struct stat;
 struct rtcdate;
+struct schedstat;
+struct threadstat;
 
 // system calls
 int fork(void);
@@ -40,6 +42,15 @@ int login(char*, char*, char*);
 int addUser(char*, char*);
 int deleteUser(char*);
 int chmod(char*, int);
+int schedstat(struct schedstat*, struct threadstat*, int);
+int sched_setaffinity(int, uint);
+int sched_getaffinity(int);
+int thread_yield_to(thread_t);
+int setrtprio(int, int);
+int setschedpolicy(int);
+int futex_wait(volatile int*, int);
+int futex_wake(volatile int*, int);
+int settls(void*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -54,3 +65,5 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+uint tlsget(uint);
+void tlsset(uint, uint);
@@ -0,0 +1,225 @@
+// User-space thread synchronization: mutex, condition
+// variable, readers-writer lock, barrier and semaphore.
+// See usync.h.
+//
+// Every blocking path follows the same pattern: a waiter
+// makes itself known (a state of 2, or nwaiters) with a
+// locked instruction, then futex_waits on the word it saw.
+// A releaser changes the word with a locked instruction and
+// then looks for waiters.  Locked instructions are ordered,
+// so either the waiter sees the new word and futex_wait
+// returns at once, or the releaser sees the waiter and
+// wakes it.
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "usync.h"
+
+#define WAKEALL  0x7fffffff  // futex_wake count for everyone
+#define WRITER   ((uint)-1)  // rwlock state held by a writer
+
+// Atomically add n to *addr and return the old value.
+uint
+fetchadd(volatile uint *addr, int n)
+{
+  uint old;
+
+  do
+    old = *addr;
+  while(cmpxchg(addr, old, old + n) != old);
+  return old;
+}
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  uint c;
+
+  if((c = cmpxchg(&m->state, 0, 1)) == 0)
+    return;
+  // Contended: mark the mutex as waited for, and sleep
+  // until an unlock finds it free for us.
+  if(c != 2)
+    c = xchg(&m->state, 2);
+  while(c != 0){
+    futex_wait((volatile int*)&m->state, 2);
+    c = xchg(&m->state, 2);
+  }
+}
+
+// Returns 0 if it got the mutex, -1 if it is held.
+int
+mutex_trylock(struct mutex *m)
+{
+  return cmpxchg(&m->state, 0, 1) == 0 ? 0 : -1;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(xchg(&m->state, 0) == 2)
+    futex_wake((volatile int*)&m->state, 1);
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->nwaiters = 0;
+}
+
+// Release m, wait for a signal, and take m again.  May
+// return without a signal, so callers recheck their
+// condition in a loop.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  uint seq;
+
+  fetchadd(&c->nwaiters, 1);
+  seq = c->seq;
+  mutex_unlock(m);
+  futex_wait((volatile int*)&c->seq, seq);
+  fetchadd(&c->nwaiters, -1);
+  // Others may be waiting for m too, so take it as
+  // contended, or an unlock could miss them.
+  while(xchg(&m->state, 2) != 0)
+    futex_wait((volatile int*)&m->state, 2);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  fetchadd(&c->seq, 1);
+  if(c->nwaiters)
+    futex_wake((volatile int*)&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  fetchadd(&c->seq, 1);
+  if(c->nwaiters)
+    futex_wake((volatile int*)&c->seq, WAKEALL);
+}
+
+void
+rwlock_init(struct rwlock *rw)
+{
+  rw->state = 0;
+  rw->nwaiters = 0;
+}
+
+void
+rwlock_rdlock(struct rwlock *rw)
+{
+  uint c;
+
+  for(;;){
+    c = rw->state;
+    if(c != WRITER){
+      if(cmpxchg(&rw->state, c, c + 1) == c)
+        return;
+      continue;
+    }
+    fetchadd(&rw->nwaiters, 1);
+    futex_wait((volatile int*)&rw->state, WRITER);
+    fetchadd(&rw->nwaiters, -1);
+  }
+}
+
+void
+rwlock_wrlock(struct rwlock *rw)
+{
+  uint c;
+
+  while((c = cmpxchg(&rw->state, 0, WRITER)) != 0){
+    fetchadd(&rw->nwaiters, 1);
+    futex_wait((volatile int*)&rw->state, c);
+    fetchadd(&rw->nwaiters, -1);
+  }
+}
+
+// Release a read or a write hold.  A writer waits for the
+// lock to come free, so only the last reader out wakes.
+void
+rwlock_unlock(struct rwlock *rw)
+{
+  if(rw->state == WRITER)
+    xchg(&rw->state, 0);
+  else if(fetchadd(&rw->state, -1) != 1)
+    return;
+  if(rw->nwaiters)
+    futex_wake((volatile int*)&rw->state, WAKEALL);
+}
+
+void
+barrier_init(struct barrier *b, uint n)
+{
+  b->n = n;
+  b->count = 0;
+  b->phase = 0;
+}
+
+// Wait until n threads have arrived.  Returns 1 in the last
+// thread to arrive and 0 in the others.
+int
+barrier_wait(struct barrier *b)
+{
+  uint phase;
+
+  phase = b->phase;
+  if(fetchadd(&b->count, 1) == b->n - 1){
+    b->count = 0;
+    fetchadd(&b->phase, 1);
+    futex_wake((volatile int*)&b->phase, WAKEALL);
+    return 1;
+  }
+  while(b->phase == phase)
+    futex_wait((volatile int*)&b->phase, phase);
+  return 0;
+}
+
+void
+sem_init(struct sem *s, uint count)
+{
+  s->count = count;
+  s->nwaiters = 0;
+}
+
+// Returns 0 if it took a unit, -1 if there was none.
+int
+sem_trywait(struct sem *s)
+{
+  uint c;
+
+  while((c = s->count) != 0)
+    if(cmpxchg(&s->count, c, c - 1) == c)
+      return 0;
+  return -1;
+}
+
+void
+sem_wait(struct sem *s)
+{
+  while(sem_trywait(s) < 0){
+    fetchadd(&s->nwaiters, 1);
+    futex_wait((volatile int*)&s->count, 0);
+    fetchadd(&s->nwaiters, -1);
+  }
+}
+
+void
+sem_post(struct sem *s)
+{
+  fetchadd(&s->count, 1);
+  if(s->nwaiters)
+    futex_wake((volatile int*)&s->count, 1);
+}
@@ -0,0 +1,65 @@
+// User-space thread synchronization (usync.c).
+// Each object is a word or two that threads share, locked
+// with xchg/cmpxchg.  Only a thread that must wait, or must
+// wake a waiter, makes a system call (futex_wait/futex_wake).
+// Initialize an object to all zeroes, or with its init
+// function, before use.
+
+// Mutex.  state is 0 unlocked, 1 locked, 2 locked and
+// maybe waited for.
+struct mutex {
+  volatile uint state;
+};
+
+// Condition variable.  seq changes on every signal.
+struct cond {
+  volatile uint seq;
+  volatile uint nwaiters;
+};
+
+// Readers-writer lock.  state is the number of readers
+// holding it, or -1 for a writer.  Readers can starve
+// writers.
+struct rwlock {
+  volatile uint state;
+  volatile uint nwaiters;
+};
+
+// Barrier for n threads.  phase changes each time all n
+// have arrived.
+struct barrier {
+  uint n;
+  volatile uint count;
+  volatile uint phase;
+};
+
+// Counting semaphore.
+struct sem {
+  volatile uint count;
+  volatile uint nwaiters;
+};
+
+uint fetchadd(volatile uint*, int);
+
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+int mutex_trylock(struct mutex*);
+void mutex_unlock(struct mutex*);
+
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+void rwlock_init(struct rwlock*);
+void rwlock_rdlock(struct rwlock*);
+void rwlock_wrlock(struct rwlock*);
+void rwlock_unlock(struct rwlock*);
+
+void barrier_init(struct barrier*, uint);
+int barrier_wait(struct barrier*);
+
+void sem_init(struct sem*, uint);
+void sem_wait(struct sem*);
+int sem_trywait(struct sem*);
+void sem_post(struct sem*);
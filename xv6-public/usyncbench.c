@@ -0,0 +1,236 @@
+// usync benchmark.
+// usage: usyncbench [nthread] [n]
+//
+// Times usync mutexes against a spin-only xchg lock, with no
+// contention and with nthread threads each taking the lock
+// n times to bump a shared counter, and checks the count.
+// Then runs a semaphore ping-pong, barrier rounds and a
+// readers-writer mix to exercise the other objects.
+// Prints cycles per operation and the elapsed ticks.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "x86.h"
+#include "usync.h"
+
+#define MAXWORKER 8
+#define DEFAULTN  20000
+
+int nthread, n;
+volatile uint counter;
+volatile uint spin;
+struct mutex mu;
+struct sem ping, pong;
+struct barrier bar;
+struct rwlock rw;
+int failed;
+
+void
+spin_lock(void)
+{
+  while(xchg(&spin, 1) != 0)
+    ;
+}
+
+void
+spin_unlock(void)
+{
+  xchg(&spin, 0);
+}
+
+void
+report(char *name, int threads, int ops, uint64 cycles, int ticks)
+{
+  int shift;
+
+  // There is no 64-bit division here, so drop low bits of
+  // cycles until it fits in 32.
+  for(shift = 0; cycles >> 32; shift++)
+    cycles >>= 1;
+  printf(1, "%s\tthreads %d\tops %d\tcycles/op %d\tticks %d\n",
+         name, threads, ops, ((uint)cycles / ops) << shift, ticks);
+}
+
+void*
+mutexworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    mutex_lock(&mu);
+    counter++;
+    mutex_unlock(&mu);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void*
+spinworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    spin_lock();
+    counter++;
+    spin_unlock();
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void*
+pongworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    sem_wait(&ping);
+    sem_post(&pong);
+  }
+  thread_exit(0);
+  return 0;
+}
+
+void*
+barrierworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < n / 10; i++)
+    barrier_wait(&bar);
+  thread_exit(0);
+  return 0;
+}
+
+// Readers check that the two halves of counter's update are
+// never seen apart; every tenth access is a write.
+volatile uint half[2];
+
+void*
+rwworker(void *arg)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(i % 10 == 0){
+      rwlock_wrlock(&rw);
+      half[0]++;
+      half[1]++;
+      rwlock_unlock(&rw);
+    } else {
+      rwlock_rdlock(&rw);
+      if(half[0] != half[1])
+        failed = 1;
+      rwlock_unlock(&rw);
+    }
+  }
+  thread_exit(0);
+  return 0;
+}
+
+// Run fn in k threads and return the cycles they took.
+uint64
+runthreads(int k, void *(*fn)(void*), int *ticks)
+{
+  thread_t tid[MAXWORKER];
+  uint64 t0;
+  void *ret;
+  int i, start;
+
+  start = uptime();
+  t0 = rdtsc();
+  for(i = 0; i < k; i++){
+    if(thread_create(&tid[i], fn, 0) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < k; i++)
+    thread_join(tid[i], &ret);
+  *ticks = uptime() - start;
+  return rdtsc() - t0;
+}
+
+void
+contended(char *name, void *(*fn)(void*))
+{
+  uint64 cycles;
+  int ticks;
+
+  counter = 0;
+  cycles = runthreads(nthread, fn, &ticks);
+  report(name, nthread, nthread*n, cycles, ticks);
+  if(counter != nthread*n){
+    printf(1, "%s: counter %d, expected %d\n", name, counter, nthread*n);
+    failed = 1;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 t0, cycles;
+  int i, start, ticks;
+  thread_t tid;
+  void *ret;
+
+  nthread = argc > 1 ? atoi(argv[1]) : 4;
+  n = argc > 2 ? atoi(argv[2]) : DEFAULTN;
+  if(nthread < 1 || nthread > MAXWORKER || n < 10){
+    printf(2, "usage: usyncbench [nthread 1..%d] [n >= 10]\n", MAXWORKER);
+    exit();
+  }
+
+  // Uncontended: one thread, no system calls for usync.
+  start = uptime();
+  t0 = rdtsc();
+  for(i = 0; i < n; i++){
+    mutex_lock(&mu);
+    mutex_unlock(&mu);
+  }
+  report("mutex1", 1, n, rdtsc() - t0, uptime() - start);
+  start = uptime();
+  t0 = rdtsc();
+  for(i = 0; i < n; i++){
+    spin_lock();
+    spin_unlock();
+  }
+  report("spin1", 1, n, rdtsc() - t0, uptime() - start);
+
+  contended("mutex", mutexworker);
+  contended("spin", spinworker);
+
+  // Semaphore ping-pong: a round trip is two posts and two
+  // waits, each of which blocks.
+  sem_init(&ping, 0);
+  sem_init(&pong, 0);
+  if(thread_create(&tid, pongworker, 0) < 0){
+    printf(1, "thread_create failed\n");
+    exit();
+  }
+  start = uptime();
+  t0 = rdtsc();
+  for(i = 0; i < n; i++){
+    sem_post(&ping);
+    sem_wait(&pong);
+  }
+  report("sem", 2, n, rdtsc() - t0, uptime() - start);
+  thread_join(tid, &ret);
+
+  barrier_init(&bar, nthread);
+  cycles = runthreads(nthread, barrierworker, &ticks);
+  report("barrier", nthread, n / 10, cycles, ticks);
+
+  rwlock_init(&rw);
+  cycles = runthreads(nthread, rwworker, &ticks);
+  report("rwlock", nthread, nthread*n, cycles, ticks);
+  if(half[0] != nthread*((n+9)/10) || half[0] != half[1]){
+    printf(1, "rwlock: %d writes, expected %d\n", half[0], nthread*((n+9)/10));
+    failed = 1;
+  }
+
+  printf(1, failed ? "usyncbench failed\n" : "usyncbench ok\n");
+  exit();
+}
@@ -4,6 +4,7 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "elf.h"
 
@@ -26,7 +27,18 @@ seginit(void)
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, 0, 0xffffffff, DPL_USER);
   c->gdt[SEG_UDATA] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
+  c->gdt[SEG_TSS] = SEG16(STS_T32A, &c->ts, sizeof(c->ts)-1, 0);
+  c->gdt[SEG_TSS].s = 0;
+  c->gdt[SEG_UTLS] = SEG(STA_W, 0, 0xffffffff, DPL_USER);
   lgdt(c->gdt, sizeof(c->gdt));
+
+  // The task register stays loaded; switching threads only
+  // changes ts.esp0.  Setting IOPL=0 in eflags *and* iomb
+  // beyond the tss segment limit forbids I/O instructions
+  // (e.g., inb and outb) from user space.
+  c->ts.ss0 = SEG_KDATA << 3;
+  c->ts.iomb = (ushort) 0xFFFF;
+  ltr(SEG_TSS << 3);
 }
 
 // Return the address of the PTE in page table pgdir
@@ -152,7 +164,9 @@ switchkvm(void)
   lcr3(V2P(kpgdir));   // switch to the kernel page table
 }
 
-// Switch TSS and h/w page table to correspond to process p.
+// Switch TSS and h/w page table to correspond to thread t
+// of process p.  Always reloads %cr3, which also flushes
+// the TLB after p's page table has changed.
 void
 switchuvm(struct proc *p, struct thread *t)
 {
@@ -164,16 +178,42 @@ switchuvm(struct proc *p, struct thread *t)
     panic("switchuvm: no pgdir");
 
   pushcli();
-  mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
-                                sizeof(mycpu()->ts)-1, 0);
-  mycpu()->gdt[SEG_TSS].s = 0;
-  mycpu()->ts.ss0 = SEG_KDATA << 3;
   mycpu()->ts.esp0 = (uint)t->kstack + KSTACKSIZE;
-  // setting IOPL=0 in eflags *and* iomb beyond the tss segment limit
-  // forbids I/O instructions (e.g., inb and outb) from user space
-  mycpu()->ts.iomb = (ushort) 0xFFFF;
-  ltr(SEG_TSS << 3);
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, t->tls, 0xffffffff, DPL_USER);
   lcr3(V2P(p->pgdir));  // switch to process's address space
+  mycpu()->pgproc = p;
+  mycpu()->pggen = p->pggen;
+  popcli();
+}
+
+// Like switchuvm, for a context switch: if p's page table is
+// already loaded, as when switching between threads of one
+// process, keep it and the TLB entries it has cached.  But
+// if another CPU has removed mappings since we loaded it,
+// p->pggen has moved on and those entries may be stale, so
+// reload.  Called with p's lock held.
+void
+switchthread(struct proc *p, struct thread *t)
+{
+  struct cpu *c;
+
+  if(t == 0)
+    panic("switchthread: no thread");
+  if(t->kstack == 0)
+    panic("switchthread: no kstack");
+  if(p->pgdir == 0)
+    panic("switchthread: no pgdir");
+
+  pushcli();
+  mycpu()->ts.esp0 = (uint)t->kstack + KSTACKSIZE;
+  // t's %gs is loaded from this entry when trapret pops it.
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, t->tls, 0xffffffff, DPL_USER);
+  c = mycpu();
+  if(c->pgproc != p || c->pggen != p->pggen || rcr3() != V2P(p->pgdir)){
+    lcr3(V2P(p->pgdir));
+    c->pgproc = p;
+    c->pggen = p->pggen;
+  }
   popcli();
 }
 